@@ -0,0 +1,786 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+//
+// Micro-benchmarks of the per-frame work done by the driver and the file
+// writer, run on synthetic frames in the raw layout the camera sends. Every
+// benchmark reports the time per frame and `allocs/frame', the number of
+// calls to `operator new' per frame.
+//
+// If `O3D3XX_BENCH_FRAME' names a file, its contents -- the raw bytes of a
+// frame, as returned by `ImageBuffer::Bytes()' -- are used instead.
+//
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <new>
+#include <string>
+#include <utility>
+#include <vector>
+#include <benchmark/benchmark.h>
+#include <boost/filesystem.hpp>
+#include <cv_bridge/cv_bridge.h>
+#include <o3d3xx.h>
+#include <opencv2/opencv.hpp>
+#include <pcl/io/pcd_io.h>
+#include <sensor_msgs/image_encodings.h>
+#include <o3d3xx_ros/black_box.h>
+#include <o3d3xx_ros/change_detector.h>
+#include <o3d3xx_ros/cloud_filter.h>
+#include <o3d3xx_ros/image_pool.h>
+#include <o3d3xx_ros/message_pool.h>
+#include <o3d3xx_ros/o3d3xx_camera.h>
+#include <o3d3xx_ros/point_cloud2.h>
+#include <o3d3xx_ros/rvl.h>
+#include <o3d3xx_ros/segment.h>
+#include <o3d3xx_ros/temporal_filter.h>
+#include <o3d3xx_ros/unit_vectors.h>
+#include <o3d3xx_ros/viz.h>
+
+//---------------------------------
+// Allocation counting
+//---------------------------------
+
+namespace
+{
+  std::atomic<std::uint64_t> allocations(0);
+}
+
+void* operator new(std::size_t size)
+{
+  allocations++;
+  void* p = std::malloc(size > 0 ? size : 1);
+  if (p == nullptr)
+    {
+      throw std::bad_alloc();
+    }
+  return p;
+}
+
+void operator delete(void* p) noexcept
+{
+  std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept
+{
+  std::free(p);
+}
+
+namespace
+{
+  /**
+   * Counts the allocations from its construction until `Report'
+   */
+  class AllocCounter
+  {
+  public:
+    AllocCounter()
+      : start_(allocations.load())
+    { }
+
+    void Report(benchmark::State& state) const
+    {
+      state.counters["allocs/frame"] =
+	benchmark::Counter(static_cast<double>(allocations - this->start_),
+			   benchmark::Counter::kAvgIterations);
+      state.SetItemsProcessed(state.iterations());
+    }
+
+  private:
+    std::uint64_t start_;
+
+  }; // end: class AllocCounter
+
+  //---------------------------------
+  // Synthetic frames
+  //---------------------------------
+
+  // chunk types and pixel formats of the camera's image chunks
+  const std::uint32_t RADIAL_DISTANCE = 100;
+  const std::uint32_t AMPLITUDE = 101;
+  const std::uint32_t CARTESIAN_X = 200;
+  const std::uint32_t CARTESIAN_Y = 201;
+  const std::uint32_t CARTESIAN_Z = 202;
+  const std::uint32_t CONFIDENCE = 300;
+
+  const std::uint32_t FORMAT_8U = 0;
+  const std::uint32_t FORMAT_16U = 2;
+  const std::uint32_t FORMAT_16S = 3;
+
+  const int ROWS = 132;
+  const int COLS = 176;
+
+  void Put32(std::vector<std::uint8_t>& bytes, std::uint32_t v)
+  {
+    const std::uint8_t* p = reinterpret_cast<const std::uint8_t*>(&v);
+    bytes.insert(bytes.end(), p, p + sizeof(v));
+  }
+
+  /**
+   * Appends an image chunk with a version 2 header and the pixels in
+   * `pixels' to `bytes'
+   */
+  template<typename T>
+  void PutChunk(std::vector<std::uint8_t>& bytes, std::uint32_t type,
+		std::uint32_t format, const std::vector<T>& pixels)
+  {
+    const std::uint32_t header_size = 48;
+    std::uint32_t size = header_size + pixels.size() * sizeof(T);
+
+    Put32(bytes, type);
+    Put32(bytes, size);
+    Put32(bytes, header_size);
+    Put32(bytes, 2);    // header version
+    Put32(bytes, COLS);
+    Put32(bytes, ROWS);
+    Put32(bytes, format);
+    Put32(bytes, 0);    // time stamp, in microseconds
+    Put32(bytes, 0);    // frame count
+    Put32(bytes, 0);    // status
+    Put32(bytes, 0);    // seconds
+    Put32(bytes, 0);    // nanoseconds
+
+    const std::uint8_t* p =
+      reinterpret_cast<const std::uint8_t*>(pixels.data());
+    bytes.insert(bytes.end(), p, p + pixels.size() * sizeof(T));
+  }
+
+  /**
+   * A frame of a slanted plane 0.5 to 5 m away with about 10% of the pixels
+   * flagged invalid, as the camera would send it
+   */
+  std::vector<std::uint8_t> SyntheticFrame()
+  {
+    const std::size_t n = ROWS * COLS;
+    std::vector<std::uint16_t> depth(n), amplitude(n);
+    std::vector<std::int16_t> x(n), y(n), z(n);
+    std::vector<std::uint8_t> confidence(n);
+
+    std::uint32_t seed = 42;
+    auto rand = [&seed]() -> std::uint32_t
+      {
+	seed = seed * 1664525u + 1013904223u;
+	return seed >> 8;
+      };
+
+    for (int r = 0; r < ROWS; ++r)
+      {
+	for (int c = 0; c < COLS; ++c)
+	  {
+	    std::size_t i = r * COLS + c;
+	    depth[i] = 500 + (4500 * (r + c)) / (ROWS + COLS) + rand() % 16;
+	    amplitude[i] = rand() % 4000;
+	    confidence[i] = (rand() % 10 == 0) ? 1 : 0;
+	    x[i] = depth[i];
+	    y[i] = (COLS / 2 - c) * depth[i] / 200;
+	    z[i] = (ROWS / 2 - r) * depth[i] / 200;
+	  }
+      }
+
+    std::vector<std::uint8_t> bytes = {'0', '0', '0', '0', 's', 't', 'a', 'r'};
+    PutChunk(bytes, RADIAL_DISTANCE, FORMAT_16U, depth);
+    PutChunk(bytes, AMPLITUDE, FORMAT_16U, amplitude);
+    PutChunk(bytes, CARTESIAN_X, FORMAT_16S, x);
+    PutChunk(bytes, CARTESIAN_Y, FORMAT_16S, y);
+    PutChunk(bytes, CARTESIAN_Z, FORMAT_16S, z);
+    PutChunk(bytes, CONFIDENCE, FORMAT_8U, confidence);
+    for (char ch : std::string("stop\r\n"))
+      {
+	bytes.push_back(ch);
+      }
+
+    return bytes;
+  }
+
+  /**
+   * The raw bytes every benchmark starts from
+   */
+  const std::vector<std::uint8_t>& FrameBytes()
+  {
+    static std::vector<std::uint8_t> bytes;
+    if (bytes.empty())
+      {
+	const char* path = std::getenv("O3D3XX_BENCH_FRAME");
+	if (path != nullptr)
+	  {
+	    std::ifstream in(path, std::ios::in | std::ios::binary);
+	    bytes.assign(std::istreambuf_iterator<char>(in),
+			 std::istreambuf_iterator<char>());
+	  }
+
+	if (bytes.empty())
+	  {
+	    bytes = SyntheticFrame();
+	  }
+      }
+
+    return bytes;
+  }
+
+  /**
+   * A parsed frame, or null (and the benchmark skipped) if the bytes could
+   * not be parsed
+   */
+  o3d3xx::ImageBuffer::Ptr Frame(benchmark::State& state)
+  {
+    o3d3xx::ImageBuffer::Ptr buff = std::make_shared<o3d3xx::ImageBuffer>();
+    std::vector<std::uint8_t> bytes = FrameBytes();
+
+    try
+      {
+	buff->SetBytes(bytes, true);
+	buff->Cloud();
+      }
+    catch (const std::exception& ex)
+      {
+	state.SkipWithError(ex.what());
+	return nullptr;
+      }
+
+    return buff;
+  }
+
+  /**
+   * A fresh directory under the system temp directory, removed along with
+   * its contents when this goes out of scope
+   */
+  class TempDir
+  {
+  public:
+    TempDir()
+      : path_(boost::filesystem::temp_directory_path() /
+	      boost::filesystem::unique_path("o3d3xx-bench-%%%%-%%%%"))
+    {
+      boost::filesystem::create_directories(this->path_);
+    }
+
+    ~TempDir()
+    {
+      boost::filesystem::remove_all(this->path_);
+    }
+
+    std::string Path() const
+    {
+      return this->path_.string();
+    }
+
+  private:
+    boost::filesystem::path path_;
+
+  }; // end: class TempDir
+
+} // end: anonymous namespace
+
+//---------------------------------
+// Driver: frame conversion
+//---------------------------------
+
+/**
+ * Parsing the raw frame into images and a point cloud, as `WaitForFrame'
+ * leaves it for `Publish'
+ */
+static void BM_Organize(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  std::vector<std::uint8_t> bytes = FrameBytes();
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      buff->SetBytes(bytes, true);
+      benchmark::DoNotOptimize(buff->Cloud());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_Organize);
+
+/**
+ * The `cloud' topic, unfiltered: the cloud is shared, not copied
+ */
+static void BM_WrapCloud(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      benchmark::DoNotOptimize(O3D3xxCamera::WrapCloud(buff));
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_WrapCloud);
+
+/**
+ * The `cloud' topic with `filter_confidence', an ROI and, for a non-zero
+ * argument, a voxel grid of that many millimeters
+ */
+static void BM_FilterCloud(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  o3d3xx_ros::CloudFilter filter(true, {0.0, -2.0, -2.0}, {4.0, 2.0, 2.0},
+				 state.range(0) / 1000.0);
+  o3d3xx_ros::MessagePool<pcl::PointCloud<o3d3xx::PointT> > pool;
+  pcl::PointCloud<o3d3xx::PointT> kept;
+  cv::Mat confidence = buff->ConfidenceImage();
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      pcl::PointCloud<o3d3xx::PointT>::Ptr cloud = pool.Get();
+      filter.Apply(*buff->Cloud(), confidence, *cloud, kept);
+      benchmark::DoNotOptimize(cloud->points.data());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_FilterCloud)->Arg(0)->Arg(20);
+
+/**
+ * The `cloud' topic as a packed `PointCloud2', `float32' (0) or `int16' (1)
+ */
+static void BM_PackCloud(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  o3d3xx_ros::cloud_encoding encoding = state.range(0) == 0 ?
+    o3d3xx_ros::cloud_encoding::FLOAT32 : o3d3xx_ros::cloud_encoding::INT16;
+  o3d3xx_ros::MessagePool<sensor_msgs::PointCloud2> pool;
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      sensor_msgs::PointCloud2Ptr msg = pool.Get();
+      o3d3xx_ros::PackCloud(*buff->Cloud(), encoding, *msg);
+      benchmark::DoNotOptimize(msg->data.data());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_PackCloud)->Arg(0)->Arg(1);
+
+/**
+ * The `depth', `amplitude' and `confidence' topics
+ */
+static void BM_ImageMessages(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  o3d3xx_ros::ImagePool depth_pool, amplitude_pool, conf_pool;
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      sensor_msgs::ImagePtr depth =
+	depth_pool.Get(buff->DepthImage(), "mono16");
+      sensor_msgs::ImagePtr amplitude =
+	amplitude_pool.Get(buff->AmplitudeImage(), "mono16");
+      sensor_msgs::ImagePtr confidence =
+	conf_pool.Get(buff->ConfidenceImage(), "mono8");
+      benchmark::DoNotOptimize(depth->data.data());
+      benchmark::DoNotOptimize(amplitude->data.data());
+      benchmark::DoNotOptimize(confidence->data.data());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_ImageMessages);
+
+/**
+ * The `frame' topic
+ */
+static void BM_FillFrame(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  o3d3xx_ros::MessagePool<o3d3xx::Frame> pool;
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      o3d3xx::FramePtr frame = pool.Get();
+      O3D3xxCamera::FillFrame(buff, *frame);
+      benchmark::DoNotOptimize(frame->xyz.data());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_FillFrame);
+
+/**
+ * The `depth_viz', `good_bad_pixels' and `hist' topics
+ */
+static void BM_Viz(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  cv::Mat depth = buff->DepthImage();
+  o3d3xx_ros::VizRenderer viz;
+  o3d3xx_ros::ImagePool depth_viz_pool, good_bad_pool, hist_pool;
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      sensor_msgs::ImagePtr depth_viz =
+	depth_viz_pool.Get(depth.rows, depth.cols, CV_8UC3, "bgr8");
+      sensor_msgs::ImagePtr good_bad =
+	good_bad_pool.Get(depth.rows, depth.cols, CV_8UC1, "mono8");
+      sensor_msgs::ImagePtr hist =
+	hist_pool.Get(o3d3xx_ros::VizRenderer::HIST_ROWS,
+		      o3d3xx_ros::VizRenderer::HIST_COLS, CV_8UC3, "bgr8");
+
+      cv::Mat depth_viz_map = o3d3xx_ros::ImagePool::Wrap(depth_viz, CV_8UC3);
+      cv::Mat good_bad_map = o3d3xx_ros::ImagePool::Wrap(good_bad, CV_8UC1);
+      cv::Mat hist_map = o3d3xx_ros::ImagePool::Wrap(hist, CV_8UC3);
+
+      viz.Render(depth, buff->AmplitudeImage(), buff->ConfidenceImage(),
+		 &depth_viz_map, &good_bad_map, &hist_map);
+      benchmark::DoNotOptimize(hist->data.data());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_Viz);
+
+/**
+ * The `depth_rvl' topic, with (1) or without (0) `rvl_mask_invalid'. The
+ * compressed size is reported as `bytes/frame'.
+ */
+static void BM_PackDepth(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  cv::Mat depth = buff->DepthImage();
+  cv::Mat confidence = buff->ConfidenceImage();
+  std::vector<std::uint8_t> data;
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      o3d3xx_ros::rvl::Encode(depth.ptr<std::uint16_t>(0),
+			      state.range(0) ?
+			      confidence.ptr<std::uint8_t>(0) : nullptr,
+			      depth.total(), data);
+      benchmark::DoNotOptimize(data.data());
+    }
+  allocs.Report(state);
+  state.counters["bytes/frame"] = data.size();
+}
+BENCHMARK(BM_PackDepth)->Arg(0)->Arg(1);
+
+/**
+ * `change_detection' on a static scene, its worst case: every pixel is
+ * compared and the frame is still suppressed.
+ */
+static void BM_ChangeDetect(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  cv::Mat depth = buff->DepthImage();
+  cv::Mat confidence = buff->ConfidenceImage();
+  o3d3xx_ros::ChangeDetector detector(20, 50, 0.0);
+  ros::Time stamp(1, 0);
+  detector.Accept(depth, confidence, stamp);
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      benchmark::DoNotOptimize(detector.Changed(depth, confidence, stamp));
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_ChangeDetect);
+
+/**
+ * `temporal_filter' on the depth and cloud, as `ema' (1) or as `median' (2)
+ * over 5 frames
+ */
+static void BM_TemporalFilter(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  cv::Mat depth = buff->DepthImage().clone();
+  cv::Mat confidence = buff->ConfidenceImage();
+  pcl::PointCloud<o3d3xx::PointT> cloud = *buff->Cloud();
+  o3d3xx_ros::TemporalFilter filter(
+    static_cast<o3d3xx_ros::temporal_mode>(state.range(0)), 0.3, 5, 100);
+  filter.Apply(depth, confidence, cloud);
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      filter.Apply(depth, confidence, cloud);
+      benchmark::DoNotOptimize(depth.data);
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_TemporalFilter)->Arg(1)->Arg(2);
+
+/**
+ * The cloud rebuilt from the depth image and the rays learned from the
+ * frame, as a subscriber to `depth_rvl', `confidence' and `unit_vectors'
+ * would
+ */
+static void BM_ReconstructCloud(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  cv::Mat depth = buff->DepthImage();
+  cv::Mat amplitude = buff->AmplitudeImage();
+  cv::Mat confidence = buff->ConfidenceImage();
+  o3d3xx_ros::UnitVectorLearner learner;
+  learner.Learn(*buff->Cloud(), depth, confidence);
+  o3d3xx::UnitVectors uv;
+  learner.Fill(uv);
+  pcl::PointCloud<o3d3xx::PointT> cloud;
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      o3d3xx_ros::ReconstructCloud(uv, depth, amplitude, confidence, cloud);
+      benchmark::DoNotOptimize(cloud.points.data());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_ReconstructCloud);
+
+//---------------------------------
+// File writer: encoders
+//---------------------------------
+
+/**
+ * A depth image as a PNG, from the message as the file writer receives it
+ */
+static void BM_EncodePNG(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  o3d3xx_ros::ImagePool pool;
+  sensor_msgs::ImageConstPtr im = pool.Get(buff->DepthImage(), "mono16");
+  std::vector<std::uint8_t> png;
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      cv_bridge::CvImageConstPtr cv_ptr =
+	cv_bridge::toCvShare(im, sensor_msgs::image_encodings::MONO16);
+      cv::imencode(".png", cv_ptr->image, png);
+      benchmark::DoNotOptimize(png.data());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_EncodePNG);
+
+/**
+ * A depth image as `dump_yaml' writes it, into memory
+ */
+static void BM_EncodeYAML(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  cv::Mat depth = buff->DepthImage();
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      cv::FileStorage storage(".yml",
+			      cv::FileStorage::WRITE | cv::FileStorage::MEMORY);
+      storage << "img" << depth;
+      benchmark::DoNotOptimize(storage.releaseAndGetString());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_EncodeYAML);
+
+/**
+ * The cloud as a PCD file, `ascii' (0), `binary' (1) or
+ * `binary_compressed' (2). PCL cannot encode into memory, so this includes
+ * writing to the temp directory.
+ */
+static void BM_EncodePCD(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  TempDir dir;
+  std::string path = dir.Path() + "/cloud.pcd";
+  std::shared_ptr<pcl::PointCloud<o3d3xx::PointT> > cloud = buff->Cloud();
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      switch (state.range(0))
+	{
+	case 0:
+	  pcl::io::savePCDFileASCII(path, *cloud);
+	  break;
+
+	case 1:
+	  pcl::io::savePCDFileBinary(path, *cloud);
+	  break;
+
+	default:
+	  pcl::io::savePCDFileBinaryCompressed(path, *cloud);
+	  break;
+	}
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_EncodePCD)->Arg(0)->Arg(1)->Arg(2);
+
+/**
+ * A cloud and three images appended to a segment (`container' mode), which
+ * includes writing to the temp directory
+ */
+static void BM_AppendSegment(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  TempDir dir;
+  o3d3xx_ros::SegmentWriter writer(dir.Path(), 256 << 20, 0.0);
+  std::shared_ptr<pcl::PointCloud<o3d3xx::PointT> > cloud = buff->Cloud();
+  std::vector<float> points(cloud->points.size() * 4);
+  std::uint32_t idx = 0;
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      for (std::size_t i = 0; i < cloud->points.size(); ++i)
+	{
+	  points[4*i] = cloud->points[i].x;
+	  points[4*i + 1] = cloud->points[i].y;
+	  points[4*i + 2] = cloud->points[i].z;
+	  points[4*i + 3] = cloud->points[i].intensity;
+	}
+
+      writer.Append(o3d3xx_ros::segment::stream::CLOUD, idx, idx,
+		    cloud->height, cloud->width,
+		    cloud->width * 4 * sizeof(float), CV_32FC4, points.data());
+
+      const std::pair<o3d3xx_ros::segment::stream, cv::Mat> images[] =
+	{{o3d3xx_ros::segment::stream::DEPTH, buff->DepthImage()},
+	 {o3d3xx_ros::segment::stream::AMPLITUDE, buff->AmplitudeImage()},
+	 {o3d3xx_ros::segment::stream::CONFIDENCE, buff->ConfidenceImage()}};
+
+      for (auto& im : images)
+	{
+	  writer.Append(im.first, idx, idx, im.second.rows, im.second.cols,
+			im.second.cols * im.second.elemSize(),
+			im.second.type(), im.second.data);
+	}
+
+      idx++;
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_AppendSegment);
+
+/**
+ * A frame's four messages held in a full black box (`pre_trigger'), which
+ * evicts the oldest ones to make room
+ */
+static void BM_BlackBoxPush(benchmark::State& state)
+{
+  o3d3xx::ImageBuffer::Ptr buff = Frame(state);
+  if (! buff)
+    {
+      return;
+    }
+
+  std::shared_ptr<pcl::PointCloud<o3d3xx::PointT> > cloud = buff->Cloud();
+  o3d3xx_ros::BlackBox<std::shared_ptr<const void> > box(
+    1000, std::chrono::hours(1));
+  std::chrono::steady_clock::time_point now =
+    std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < box.Capacity(); ++i)
+    {
+      box.Push(cloud, now);
+    }
+
+  AllocCounter allocs;
+  for (auto _ : state)
+    {
+      for (int i = 0; i < 4; ++i)
+	{
+	  box.Push(cloud, now);
+	}
+      benchmark::DoNotOptimize(box.Size());
+    }
+  allocs.Report(state);
+}
+BENCHMARK(BM_BlackBoxPush);
+
+BENCHMARK_MAIN();
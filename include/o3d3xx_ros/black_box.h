@@ -0,0 +1,148 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_BLACK_BOX_H__
+#define __O3D3XX_ROS_BLACK_BOX_H__
+
+#include <chrono>
+#include <cstddef>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+namespace o3d3xx_ros
+{
+  /**
+   * Holds on to the items of the last `window' of time, at most `capacity'
+   * of them, oldest first -- the memory of a flight recorder.
+   *
+   * The slots are allocated once, up front; pushing an item moves it into
+   * the slot of the oldest one when full, and items that have aged out of
+   * the window are released as soon as a newer one comes in, so holding on
+   * to, e.g., message pointers does not keep more than `window' of them
+   * alive.
+   *
+   * A black box is not thread-safe.
+   */
+  template <typename T>
+  class BlackBox
+  {
+  public:
+    using clock = std::chrono::steady_clock;
+
+    BlackBox(std::size_t capacity, clock::duration window)
+      : slots_(capacity),
+	window_(window),
+	head_(0),
+	size_(0)
+    {
+      if (capacity < 1)
+	{
+	  throw std::runtime_error("black_box_size must be at least 1");
+	}
+    }
+
+    std::size_t Size() const
+    {
+      return this->size_;
+    }
+
+    std::size_t Capacity() const
+    {
+      return this->slots_.size();
+    }
+
+    /**
+     * Time between the oldest and the newest item held
+     */
+    clock::duration Span() const
+    {
+      if (this->size_ == 0)
+	{
+	  return clock::duration::zero();
+	}
+
+      return this->slots_[this->Index(this->size_ - 1)].at -
+	this->slots_[this->head_].at;
+    }
+
+    /**
+     * Adds `item', received `at', evicting whatever is older than `window'
+     * by then and, if still full, the oldest item
+     */
+    void Push(T item, clock::time_point at)
+    {
+      while ((this->size_ > 0) &&
+	     (at - this->slots_[this->head_].at > this->window_))
+	{
+	  this->PopFront();
+	}
+
+      if (this->size_ == this->slots_.size())
+	{
+	  this->PopFront();
+	}
+
+      Slot& slot = this->slots_[this->Index(this->size_)];
+      slot.item = std::move(item);
+      slot.at = at;
+      this->size_++;
+    }
+
+    /**
+     * Hands every item held to `f', oldest first, and empties the box
+     */
+    template <typename F>
+    void Drain(F f)
+    {
+      while (this->size_ > 0)
+	{
+	  f(this->slots_[this->head_].item);
+	  this->PopFront();
+	}
+    }
+
+  private:
+    struct Slot
+    {
+      T item;
+      clock::time_point at;
+    };
+
+    std::size_t Index(std::size_t i) const
+    {
+      return (this->head_ + i) % this->slots_.size();
+    }
+
+    void PopFront()
+    {
+      this->slots_[this->head_].item = T();
+      this->head_ = this->Index(1);
+      this->size_--;
+    }
+
+    std::vector<Slot> slots_;
+    clock::duration window_;
+
+    // slot of the oldest item, and the number of items held
+    std::size_t head_;
+    std::size_t size_;
+
+  }; // end: class BlackBox
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_BLACK_BOX_H__
@@ -0,0 +1,250 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_BOUNDED_QUEUE_H__
+#define __O3D3XX_ROS_BOUNDED_QUEUE_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <utility>
+
+namespace o3d3xx_ros
+{
+  /**
+   * Fixed capacity ring buffer that is lock-free on the `TryPush' and
+   * `TryPop' paths.
+   *
+   * The algorithm is Dmitry Vyukov's bounded MPMC queue: every slot carries a
+   * sequence number that tells producers and consumers whether it is theirs
+   * to use, so a producer may also pop from the queue (e.g., to implement a
+   * drop-oldest policy) without racing the consumers.
+   *
+   * `Push' and `Pop' wrap the lock-free calls and sleep on a condition
+   * variable when the queue is full or empty, respectively. The mutex is
+   * only ever touched when somebody is actually waiting.
+   */
+  template<typename T>
+  class BoundedQueue
+  {
+  public:
+    explicit BoundedQueue(std::size_t capacity)
+      : capacity_(capacity > 0 ? capacity : 1),
+	slots_(new Slot[capacity_]),
+	head_(0),
+	tail_(0),
+	waiters_(0)
+    {
+      for (std::size_t i = 0; i < this->capacity_; ++i)
+	{
+	  this->slots_[i].seq.store(i, std::memory_order_relaxed);
+	}
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    std::size_t Capacity() const
+    {
+      return this->capacity_;
+    }
+
+    /**
+     * Approximate number of items in the queue.
+     */
+    std::size_t Size() const
+    {
+      std::size_t head = this->head_.load(std::memory_order_relaxed);
+      std::size_t tail = this->tail_.load(std::memory_order_relaxed);
+      return tail > head ? tail - head : 0;
+    }
+
+    /**
+     * Adds a copy of `item' to the queue. Returns false, and leaves the queue
+     * untouched, if the queue is full.
+     */
+    bool TryPush(const T& item)
+    {
+      if (! this->Enqueue(item))
+	{
+	  return false;
+	}
+
+      this->Notify();
+      return true;
+    }
+
+    /**
+     * Moves the oldest item in the queue into `item'. Returns false if the
+     * queue is empty.
+     */
+    bool TryPop(T& item)
+    {
+      if (! this->Dequeue(item))
+	{
+	  return false;
+	}
+
+      this->Notify();
+      return true;
+    }
+
+    /**
+     * Like `TryPush' but waits up to `timeout_millis' for room in the queue.
+     */
+    bool Push(const T& item, int timeout_millis)
+    {
+      return this->Wait([this, &item]() { return this->Enqueue(item); },
+			timeout_millis);
+    }
+
+    /**
+     * Like `TryPop' but waits up to `timeout_millis' for an item.
+     */
+    bool Pop(T& item, int timeout_millis)
+    {
+      return this->Wait([this, &item]() { return this->Dequeue(item); },
+			timeout_millis);
+    }
+
+  private:
+    struct Slot
+    {
+      std::atomic<std::size_t> seq;
+      T item;
+    };
+
+    bool Enqueue(const T& item)
+    {
+      std::size_t pos = this->tail_.load(std::memory_order_relaxed);
+      for (;;)
+	{
+	  Slot& slot = this->slots_[pos % this->capacity_];
+	  std::size_t seq = slot.seq.load(std::memory_order_acquire);
+	  std::intptr_t diff = (std::intptr_t) seq - (std::intptr_t) pos;
+
+	  if (diff == 0)
+	    {
+	      if (this->tail_.compare_exchange_weak(
+		    pos, pos + 1, std::memory_order_relaxed))
+		{
+		  slot.item = item;
+		  slot.seq.store(pos + 1, std::memory_order_release);
+		  return true;
+		}
+	    }
+	  else if (diff < 0)
+	    {
+	      return false; // full
+	    }
+	  else
+	    {
+	      pos = this->tail_.load(std::memory_order_relaxed);
+	    }
+	}
+    }
+
+    bool Dequeue(T& item)
+    {
+      std::size_t pos = this->head_.load(std::memory_order_relaxed);
+      for (;;)
+	{
+	  Slot& slot = this->slots_[pos % this->capacity_];
+	  std::size_t seq = slot.seq.load(std::memory_order_acquire);
+	  std::intptr_t diff = (std::intptr_t) seq - (std::intptr_t) (pos + 1);
+
+	  if (diff == 0)
+	    {
+	      if (this->head_.compare_exchange_weak(
+		    pos, pos + 1, std::memory_order_relaxed))
+		{
+		  item = std::move(slot.item);
+		  slot.item = T();
+		  slot.seq.store(pos + this->capacity_,
+				 std::memory_order_release);
+		  return true;
+		}
+	    }
+	  else if (diff < 0)
+	    {
+	      return false; // empty
+	    }
+	  else
+	    {
+	      pos = this->head_.load(std::memory_order_relaxed);
+	    }
+	}
+    }
+
+    template<typename F>
+    bool Wait(F op, int timeout_millis)
+    {
+      bool ok = op();
+
+      if (! ok)
+	{
+	  std::unique_lock<std::mutex> lock(this->mutex_);
+	  this->waiters_.fetch_add(1);
+	  std::atomic_thread_fence(std::memory_order_seq_cst);
+	  ok = this->cv_.wait_for(lock,
+				  std::chrono::milliseconds(timeout_millis),
+				  op);
+	  this->waiters_.fetch_sub(1);
+	}
+
+      if (ok)
+	{
+	  this->Notify();
+	}
+
+      return ok;
+    }
+
+    void Notify()
+    {
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (this->waiters_.load(std::memory_order_relaxed) > 0)
+	{
+	  // taking the lock orders us after a waiter's predicate check so its
+	  // wakeup cannot be lost
+	  { std::lock_guard<std::mutex> lock(this->mutex_); }
+	  this->cv_.notify_all();
+	}
+    }
+
+    const std::size_t capacity_;
+    std::unique_ptr<Slot[]> slots_;
+
+    // keep the producer and consumer indices on separate cache lines
+    char pad0_[64];
+    std::atomic<std::size_t> head_;
+    char pad1_[64];
+    std::atomic<std::size_t> tail_;
+    char pad2_[64];
+
+    std::atomic<int> waiters_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+
+  }; // end: class BoundedQueue
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_BOUNDED_QUEUE_H__
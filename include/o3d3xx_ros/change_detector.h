@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_CHANGE_DETECTOR_H__
+#define __O3D3XX_ROS_CHANGE_DETECTOR_H__
+
+#include <cstdint>
+#include <stdexcept>
+#include <opencv2/opencv.hpp>
+#include <ros/ros.h>
+
+namespace o3d3xx_ros
+{
+  /**
+   * Tells frames of a changing scene from those of a static one by
+   * comparing their depth image against that of the last frame let through,
+   * the reference.
+   *
+   * A pixel has changed if it is valid (bit 0 of its confidence clear) in
+   * one frame but not the other, or valid in both and its depth differs by
+   * more than `tolerance' millimeters. A frame is let through, and is made
+   * the reference with `Accept', if at least `min_pixels' pixels have
+   * changed, or if `heartbeat' seconds have passed since the last frame let
+   * through (0 disables the heartbeat).
+   *
+   * Slow drift thus shows up once it adds up to a change, and is not
+   * absorbed into the reference.
+   *
+   * A detector is not thread-safe.
+   */
+  class ChangeDetector
+  {
+  public:
+    ChangeDetector(int tolerance, int min_pixels, double heartbeat)
+      : tolerance_(tolerance),
+	min_pixels_(min_pixels),
+	heartbeat_(ros::Duration(heartbeat))
+    {
+      if ((tolerance < 0) || (min_pixels < 1) || (heartbeat < 0.0))
+	{
+	  throw std::runtime_error("Invalid change detection parameters");
+	}
+    }
+
+    /**
+     * `depth' is the CV_16UC1 and `confidence' the CV_8UC1 image of the
+     * frame stamped `stamp'. Returns true if the frame is to be let through;
+     * it only becomes the reference once passed to `Accept', so a frame
+     * that is held back for another reason does not mask the change.
+     */
+    bool Changed(const cv::Mat& depth, const cv::Mat& confidence,
+		 const ros::Time& stamp) const
+    {
+      return this->ref_depth_.empty() ||
+	(this->ref_depth_.rows != depth.rows) ||
+	(this->ref_depth_.cols != depth.cols) ||
+	(this->ref_conf_.total() != confidence.total()) ||
+	(stamp < this->ref_stamp_) ||
+	((this->heartbeat_ > ros::Duration(0)) &&
+	 (stamp - this->ref_stamp_ >= this->heartbeat_)) ||
+	(this->CountChanges(depth, confidence) >= this->min_pixels_);
+    }
+
+    /**
+     * Makes the frame the reference, once it is let through
+     */
+    void Accept(const cv::Mat& depth, const cv::Mat& confidence,
+		const ros::Time& stamp)
+    {
+      depth.copyTo(this->ref_depth_);
+      confidence.copyTo(this->ref_conf_);
+      this->ref_stamp_ = stamp;
+    }
+
+  private:
+    /**
+     * Changed pixels, counted only up to `min_pixels_'
+     */
+    int CountChanges(const cv::Mat& depth, const cv::Mat& confidence) const
+    {
+      int changed = 0;
+      for (int r = 0; (r < depth.rows) && (changed < this->min_pixels_); ++r)
+	{
+	  const std::uint16_t* d = depth.ptr<std::uint16_t>(r);
+	  const std::uint16_t* ref_d = this->ref_depth_.ptr<std::uint16_t>(r);
+	  const std::uint8_t* c = confidence.ptr<std::uint8_t>(r);
+	  const std::uint8_t* ref_c = this->ref_conf_.ptr<std::uint8_t>(r);
+
+	  for (int col = 0; col < depth.cols; ++col)
+	    {
+	      int invalid = c[col] & 1;
+	      int ref_invalid = ref_c[col] & 1;
+	      int diff = static_cast<int>(d[col]) - ref_d[col];
+	      diff = diff < 0 ? -diff : diff;
+
+	      changed += (invalid != ref_invalid) ||
+		(! invalid && (diff > this->tolerance_));
+	    }
+	}
+
+      return changed;
+    }
+
+    int tolerance_;
+    int min_pixels_;
+    ros::Duration heartbeat_;
+    cv::Mat ref_depth_;
+    cv::Mat ref_conf_;
+    ros::Time ref_stamp_;
+
+  }; // end: class ChangeDetector
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_CHANGE_DETECTOR_H__
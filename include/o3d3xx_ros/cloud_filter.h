@@ -0,0 +1,170 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_CLOUD_FILTER_H__
+#define __O3D3XX_ROS_CLOUD_FILTER_H__
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <o3d3xx/image.h>
+#include <opencv2/opencv.hpp>
+#include <pcl/filters/voxel_grid.h>
+#include <pcl/point_cloud.h>
+
+namespace o3d3xx_ros
+{
+  /**
+   * Turns the organized cloud from the camera into a sparse one, keeping
+   * only the points that are valid (bit 0 of their confidence is clear)
+   * and/or inside an axis-aligned box, optionally decimated by a voxel grid.
+   * Points with non-finite coordinates are always dropped, so the result
+   * is dense.
+   *
+   * The configuration is fixed at construction, so one filter may be shared
+   * by several publishing threads.
+   */
+  class CloudFilter
+  {
+  public:
+    /**
+     * `roi_min'/`roi_max' are the corners of the box, in the frame of the
+     * cloud; pass empty vectors to keep points anywhere. A `voxel_size' of
+     * 0 disables the voxel grid.
+     */
+    CloudFilter(bool mask_invalid, const std::vector<double>& roi_min,
+		const std::vector<double>& roi_max, double voxel_size)
+      : mask_invalid_(mask_invalid),
+	roi_(false),
+	voxel_size_(voxel_size)
+    {
+      if (roi_min.empty() != roi_max.empty())
+	{
+	  throw std::runtime_error("roi_min and roi_max must be set together");
+	}
+
+      if (! roi_min.empty())
+	{
+	  if ((roi_min.size() != 3) || (roi_max.size() != 3))
+	    {
+	      throw std::runtime_error("roi_min and roi_max must be [x, y, z]");
+	    }
+
+	  this->roi_ = true;
+	  for (int i = 0; i < 3; ++i)
+	    {
+	      this->min_[i] = roi_min[i];
+	      this->max_[i] = roi_max[i];
+	    }
+	}
+
+      if (this->voxel_size_ < 0.0)
+	{
+	  throw std::runtime_error("voxel_size must not be negative");
+	}
+    }
+
+    /**
+     * True if any of the stages is turned on
+     */
+    bool Enabled() const
+    {
+      return this->mask_invalid_ || this->roi_ || (this->voxel_size_ > 0.0);
+    }
+
+    /**
+     * Filters `in', whose points correspond, row by row, to the pixels of
+     * the CV_8UC1 `confidence' image, into the unorganized `out'. `kept' is
+     * scratch space for the voxel grid input and is reused from call to
+     * call. The header of `out' is left alone.
+     */
+    void Apply(const pcl::PointCloud<o3d3xx::PointT>& in,
+	       const cv::Mat& confidence,
+	       pcl::PointCloud<o3d3xx::PointT>& out,
+	       pcl::PointCloud<o3d3xx::PointT>& kept) const
+    {
+      pcl::PointCloud<o3d3xx::PointT>& dest =
+	this->voxel_size_ > 0.0 ? kept : out;
+
+      bool mask = this->mask_invalid_ &&
+	(confidence.total() == in.points.size());
+
+      dest.points.resize(in.points.size());
+      std::size_t n = 0;
+
+      for (std::size_t i = 0; i < in.points.size(); ++i)
+	{
+	  const o3d3xx::PointT& pt = in.points[i];
+
+	  if (mask && (confidence.ptr<std::uint8_t>(i / confidence.cols)
+		       [i % confidence.cols] & 1))
+	    {
+	      continue;
+	    }
+
+	  // NaN fails every comparison of the ROI test, so it is caught here
+	  if (! (std::isfinite(pt.x) && std::isfinite(pt.y) &&
+		 std::isfinite(pt.z)))
+	    {
+	      continue;
+	    }
+
+	  if (this->roi_ &&
+	      ((pt.x < this->min_[0]) || (pt.x > this->max_[0]) ||
+	       (pt.y < this->min_[1]) || (pt.y > this->max_[1]) ||
+	       (pt.z < this->min_[2]) || (pt.z > this->max_[2])))
+	    {
+	      continue;
+	    }
+
+	  dest.points[n++] = pt;
+	}
+
+      dest.points.resize(n);
+      dest.width = n;
+      dest.height = 1;
+      // as every non-finite point was dropped; VoxelGrid relies on it
+      dest.is_dense = true;
+
+      if (this->voxel_size_ > 0.0)
+	{
+	  // VoxelGrid wants a shared pointer; `kept' outlives the call
+	  pcl::PointCloud<o3d3xx::PointT>::ConstPtr input(
+	    &kept, [](const pcl::PointCloud<o3d3xx::PointT>*) { });
+
+	  pcl::VoxelGrid<o3d3xx::PointT> grid;
+	  grid.setInputCloud(input);
+	  grid.setLeafSize(this->voxel_size_, this->voxel_size_,
+			   this->voxel_size_);
+	  grid.filter(out);
+	}
+    }
+
+  private:
+    bool mask_invalid_;
+    bool roi_;
+    float min_[3];
+    float max_[3];
+    double voxel_size_;
+
+  }; // end: class CloudFilter
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_CLOUD_FILTER_H__
@@ -0,0 +1,341 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_CONFIG_DIFF_H__
+#define __O3D3XX_ROS_CONFIG_DIFF_H__
+
+#include <cstdlib>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <boost/optional.hpp>
+#include <boost/property_tree/json_parser.hpp>
+#include <boost/property_tree/ptree.hpp>
+
+/**
+ * Helpers to compare camera configurations in the JSON layout of
+ * `o3d3xx::Camera::ToJSON' / `FromJSON', so only what actually changed
+ * needs to be pushed to the camera.
+ *
+ * Entries of the `Apps' array are matched by their `Index'; entries
+ * without one describe applications to be created.
+ *
+ * Changing the `Type' of an app's `Imager' makes the camera reset all the
+ * other imager parameters to the defaults of the new type, so a diff that
+ * changes it carries the whole requested `Imager', and applying it leaves
+ * the configuration to be reloaded from the camera.
+ */
+namespace o3d3xx_ros
+{
+  namespace config
+  {
+    typedef boost::property_tree::ptree ptree;
+
+    inline ptree Parse(const std::string& json)
+    {
+      ptree tree;
+      std::istringstream in(json);
+      boost::property_tree::read_json(in, tree);
+      return tree;
+    }
+
+    inline std::string Serialize(const ptree& tree)
+    {
+      std::ostringstream out;
+      boost::property_tree::write_json(out, tree);
+      return out.str();
+    }
+
+    /**
+     * Read-only information `ToJSON' reports alongside the configuration
+     * (and `FromJSON' ignores), which must not count as a change.
+     */
+    inline bool ReadOnly(const std::string& key)
+    {
+      return (key == "libo3d3xx") || (key == "Date") ||
+	(key == "HWInfo") || (key == "SWVersion") || (key == "UpTime") ||
+	(key == "TemperatureFront1") || (key == "TemperatureFront2") ||
+	(key == "TemperatureIMX6") || (key == "TemperatureIllu");
+    }
+
+    /**
+     * Finds the element of the array `arr' whose `Index' is `idx'
+     */
+    inline const ptree* FindIndex(const ptree& arr, const std::string& idx)
+    {
+      for (auto& kv : arr)
+	{
+	  boost::optional<std::string> i =
+	    kv.second.get_optional<std::string>("Index");
+	  if (i && (*i == idx))
+	    {
+	      return &kv.second;
+	    }
+	}
+
+      return nullptr;
+    }
+
+    /**
+     * Whether `wanted', an `Imager' subtree, sets a `Type' other than that of
+     * `current' (which may be null)
+     */
+    inline bool ImagerTypeChanged(const ptree& wanted, const ptree* current)
+    {
+      boost::optional<std::string> type =
+	wanted.get_optional<std::string>("Type");
+      if (! type)
+	{
+	  return false;
+	}
+
+      boost::optional<std::string> cur_type = current != nullptr ?
+	current->get_optional<std::string>("Type") :
+	boost::optional<std::string>();
+      return (! cur_type) || (*cur_type != *type);
+    }
+
+    /**
+     * Sets `diff' to the parts of `wanted' that are missing from or differ
+     * in `current' (which may be null). Returns true if there are any.
+     */
+    inline bool Diff(const ptree& wanted, const ptree* current, ptree& diff)
+    {
+      diff.clear();
+
+      if (wanted.empty())
+	{
+	  diff.data() = wanted.data();
+	  return (current == nullptr) || (current->data() != wanted.data());
+	}
+
+      bool changed = false;
+      for (auto& kv : wanted)
+	{
+	  ptree sub;
+
+	  if (kv.first.empty())
+	    {
+	      // array element: an app, matched by index
+	      boost::optional<std::string> idx =
+		kv.second.get_optional<std::string>("Index");
+	      const ptree* cur =
+		(current != nullptr) && idx ? FindIndex(*current, *idx) : nullptr;
+
+	      if ((cur == nullptr) || ! idx)
+		{
+		  sub = kv.second;
+		}
+	      else if (Diff(kv.second, cur, sub))
+		{
+		  // FromJSON needs the index to know which app to edit
+		  sub.put("Index", *idx);
+		}
+	      else
+		{
+		  continue;
+		}
+	    }
+	  else
+	    {
+	      if (ReadOnly(kv.first))
+		{
+		  continue;
+		}
+
+	      boost::optional<const ptree&> cur =
+		current != nullptr ?
+		current->get_child_optional(ptree::path_type(kv.first, '\0')) :
+		boost::optional<const ptree&>();
+
+	      if ((kv.first == "Imager") &&
+		  ImagerTypeChanged(kv.second, cur ? &*cur : nullptr))
+		{
+		  // the camera resets what is left out, so leave nothing out
+		  sub = kv.second;
+		}
+	      else if (! Diff(kv.second, cur ? &*cur : nullptr, sub))
+		{
+		  continue;
+		}
+	    }
+
+	  diff.push_back(std::make_pair(kv.first, sub));
+	  changed = true;
+	}
+
+      return changed;
+    }
+
+    /**
+     * Applies a `diff' computed by `Diff' to `current'. Returns false if
+     * the result cannot be known without asking the camera, i.e., the diff
+     * creates applications or changes an imager's `Type', in which case
+     * `current' must be reloaded.
+     */
+    inline bool Merge(const ptree& diff, ptree& current)
+    {
+      if (diff.empty())
+	{
+	  current.data() = diff.data();
+	  return true;
+	}
+
+      for (auto& kv : diff)
+	{
+	  if (kv.first.empty())
+	    {
+	      boost::optional<std::string> idx =
+		kv.second.get_optional<std::string>("Index");
+	      ptree* cur = idx ?
+		const_cast<ptree*>(FindIndex(current, *idx)) : nullptr;
+
+	      if ((cur == nullptr) || ! Merge(kv.second, *cur))
+		{
+		  return false;
+		}
+	    }
+	  else
+	    {
+	      ptree::path_type path(kv.first, '\0');
+	      boost::optional<ptree&> cur = current.get_child_optional(path);
+	      if ((kv.first == "Imager") &&
+		  ImagerTypeChanged(kv.second, cur ? &*cur : nullptr))
+		{
+		  return false;
+		}
+
+	      if (! cur)
+		{
+		  cur = current.put_child(path, ptree());
+		}
+
+	      if (! Merge(kv.second, *cur))
+		{
+		  return false;
+		}
+	    }
+	}
+
+      return true;
+    }
+
+    /**
+     * Whether the values `a' and `b' are the same, as strings or, e.g.
+     * "0" and "0.0", as numbers
+     */
+    inline bool SameValue(const std::string& a, const std::string& b)
+    {
+      if (a == b)
+	{
+	  return true;
+	}
+
+      char* a_end = nullptr;
+      char* b_end = nullptr;
+      double x = std::strtod(a.c_str(), &a_end);
+      double y = std::strtod(b.c_str(), &b_end);
+      return (! a.empty()) && (! b.empty()) && (*a_end == '\0') &&
+	(*b_end == '\0') && (x == y);
+    }
+
+    typedef std::unordered_map<std::string, std::string> params;
+
+    /**
+     * Whether `cached', a whole configuration as dumped by `ToJSON', still
+     * describes the camera that reports the hardware info `hw', the device
+     * parameters `device' and the applications `apps', as (index, id)
+     * pairs -- all of which the camera tells without leaving run mode, so
+     * a configuration kept from an earlier run can be checked cheaply.
+     *
+     * This catches another camera at the same address, device settings and
+     * applications changed by another client; edits to the parameters
+     * within an existing application go unnoticed.
+     */
+    inline bool Matches(const ptree& cached, const params& hw,
+			const params& device,
+			const std::vector<std::pair<std::string,
+						    std::string> >& apps)
+    {
+      boost::optional<const ptree&> root = cached.get_child_optional("o3d3xx");
+      if (! root)
+	{
+	  return false;
+	}
+
+      // the read-only hardware info is what tells cameras apart
+      boost::optional<const ptree&> cached_hw =
+	root->get_child_optional("HWInfo");
+      if (cached_hw)
+	{
+	  for (auto& kv : *cached_hw)
+	    {
+	      params::const_iterator it = hw.find(kv.first);
+	      if ((it == hw.end()) || (it->second != kv.second.data()))
+		{
+		  return false;
+		}
+	    }
+	}
+
+      boost::optional<const ptree&> cached_dev =
+	root->get_child_optional("Device");
+      if (! cached_dev)
+	{
+	  return false;
+	}
+
+      for (auto& kv : *cached_dev)
+	{
+	  if (ReadOnly(kv.first))
+	    {
+	      continue;
+	    }
+
+	  params::const_iterator it = device.find(kv.first);
+	  if ((it == device.end()) || ! SameValue(it->second, kv.second.data()))
+	    {
+	      return false;
+	    }
+	}
+
+      boost::optional<const ptree&> cached_apps =
+	root->get_child_optional("Apps");
+      if ((cached_apps ? cached_apps->size() : 0) != apps.size())
+	{
+	  return false;
+	}
+
+      for (auto& app : apps)
+	{
+	  const ptree* cur = FindIndex(*cached_apps, app.first);
+	  if ((cur == nullptr) ||
+	      (cur->get<std::string>("Id", app.second) != app.second))
+	    {
+	      return false;
+	    }
+	}
+
+      return true;
+    }
+
+  } // end: namespace config
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_CONFIG_DIFF_H__
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_IMAGE_POOL_H__
+#define __O3D3XX_ROS_IMAGE_POOL_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <opencv2/opencv.hpp>
+#include <sensor_msgs/Image.h>
+#include <o3d3xx_ros/message_pool.h>
+
+namespace o3d3xx_ros
+{
+  /**
+   * A `MessagePool' of `sensor_msgs::Image' that also sizes and fills the
+   * recycled messages from OpenCV images.
+   *
+   * A pool is not thread-safe, each publishing thread should own its own.
+   */
+  class ImagePool
+  {
+  public:
+    explicit ImagePool(std::size_t capacity = 4)
+      : pool_(capacity)
+    { }
+
+    /**
+     * Returns a message with room for a `rows' x `cols' image of OpenCV type
+     * `type'. The pixel data are left as they were.
+     */
+    sensor_msgs::ImagePtr Get(int rows, int cols, int type,
+			      const std::string& encoding)
+    {
+      sensor_msgs::ImagePtr msg = this->pool_.Get();
+      msg->height = rows;
+      msg->width = cols;
+      msg->encoding = encoding;
+      msg->is_bigendian = ImagePool::BigEndian();
+      msg->step = cols * CV_ELEM_SIZE(type);
+      msg->data.resize(msg->step * rows);
+      return msg;
+    }
+
+    /**
+     * Returns a message holding a copy of `img'.
+     */
+    sensor_msgs::ImagePtr Get(const cv::Mat& img, const std::string& encoding)
+    {
+      sensor_msgs::ImagePtr msg =
+	this->Get(img.rows, img.cols, img.type(), encoding);
+
+      if (img.isContinuous())
+	{
+	  std::memcpy(msg->data.data(), img.data, msg->data.size());
+	}
+      else
+	{
+	  img.copyTo(ImagePool::Wrap(msg, img.type()));
+	}
+
+      return msg;
+    }
+
+    /**
+     * Returns a cv::Mat that aliases the pixel data of `msg', so OpenCV
+     * functions can write their output straight into the message.
+     */
+    static cv::Mat Wrap(const sensor_msgs::ImagePtr& msg, int type)
+    {
+      return cv::Mat(msg->height, msg->width, type,
+		     msg->data.data(), msg->step);
+    }
+
+  private:
+    static bool BigEndian()
+    {
+      const std::uint16_t one = 1;
+      return *reinterpret_cast<const std::uint8_t*>(&one) == 0;
+    }
+
+    o3d3xx_ros::MessagePool<sensor_msgs::Image> pool_;
+
+  }; // end: class ImagePool
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_IMAGE_POOL_H__
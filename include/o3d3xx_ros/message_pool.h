@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_MESSAGE_POOL_H__
+#define __O3D3XX_ROS_MESSAGE_POOL_H__
+
+#include <cstddef>
+#include <vector>
+#include <boost/make_shared.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace o3d3xx_ros
+{
+  /**
+   * A small set of messages that are handed out again once nobody but the
+   * pool references them anymore.
+   *
+   * Remote subscribers are served by serializing the message inside
+   * `publish()', intra-process subscribers hold on to the shared pointer, so
+   * a message is only reused after the transport has dropped it. Since the
+   * size of the data a camera stream produces does not change from frame to
+   * frame, the array fields of a recycled message already have the right size
+   * and refilling them does not allocate.
+   *
+   * A pool is not thread-safe, each publishing thread should own its own.
+   */
+  template<typename M>
+  class MessagePool
+  {
+  public:
+    explicit MessagePool(std::size_t capacity = 4)
+      : capacity_(capacity)
+    { }
+
+    /**
+     * Returns a message that is not referenced anywhere else. Its fields
+     * hold whatever they held when last published.
+     */
+    boost::shared_ptr<M> Get()
+    {
+      for (auto& m : this->pool_)
+	{
+	  if (m.use_count() == 1)
+	    {
+	      return m;
+	    }
+	}
+
+      boost::shared_ptr<M> msg = boost::make_shared<M>();
+      if (this->pool_.size() < this->capacity_)
+	{
+	  this->pool_.push_back(msg);
+	}
+
+      return msg;
+    }
+
+  private:
+    std::size_t capacity_;
+    std::vector<boost::shared_ptr<M> > pool_;
+
+  }; // end: class MessagePool
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_MESSAGE_POOL_H__
@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_METADATA_CACHE_H__
+#define __O3D3XX_ROS_METADATA_CACHE_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <o3d3xx/UnitVectors.h>
+
+namespace o3d3xx_ros
+{
+  namespace metadata
+  {
+    const char UNIT_VECTORS_MAGIC[8] = {'O','3','D','U','V','E','C','1'};
+
+    // bound on the image size a unit vector file may claim
+    const std::uint32_t MAX_SIDE = 4096;
+
+    /**
+     * Layout of a unit vector file (native-endian): this header, then the
+     * x, y and z planes as height * width float32 each
+     */
+    struct UnitVectorsHeader
+    {
+      char magic[8];
+      std::uint32_t height;
+      std::uint32_t width;
+      float origin[3];
+      std::uint32_t complete;
+    };
+
+  } // end: namespace metadata
+
+  /**
+   * What is worth remembering about a camera from one run to the next,
+   * because getting it from the camera again is slow or interrupts
+   * streaming: the JSON dump of its configuration and the learned unit
+   * vectors. Kept as `config.json' and `unit_vectors.bin' in a directory of
+   * its own per camera, named after its IP address and XMLRPC port.
+   *
+   * Files are replaced atomically, by writing a temporary file and renaming
+   * it over the old one, so a crash never leaves a torn file for the next
+   * run. Failing to save throws; a missing or unreadable file just loads as
+   * nothing.
+   */
+  class MetadataCache
+  {
+  public:
+    MetadataCache(const std::string& dir, const std::string& ip, int port)
+      : dir_(dir + "/" + ip + "_" + std::to_string(port))
+    {
+      boost::system::error_code ec;
+      boost::filesystem::create_directories(this->dir_, ec);
+      if (! boost::filesystem::is_directory(this->dir_))
+	{
+	  throw std::runtime_error("Could not create cache directory: " +
+				   this->dir_);
+	}
+    }
+
+    const std::string& Dir() const
+    {
+      return this->dir_;
+    }
+
+    bool LoadConfig(std::string& json) const
+    {
+      std::ifstream in(this->dir_ + "/config.json",
+		       std::ios::in | std::ios::binary);
+      if (! in)
+	{
+	  return false;
+	}
+
+      json.assign(std::istreambuf_iterator<char>(in),
+		  std::istreambuf_iterator<char>());
+      return ! json.empty();
+    }
+
+    void SaveConfig(const std::string& json) const
+    {
+      this->Save("config.json", json.data(), json.size(), nullptr, 0);
+    }
+
+    /**
+     * Removes the saved configuration, e.g., because it is being changed
+     */
+    void ForgetConfig() const
+    {
+      std::remove((this->dir_ + "/config.json").c_str());
+    }
+
+    /**
+     * Loads the table saved by `SaveUnitVectors' into all of `msg' but the
+     * header. Returns false if there is none or it is not consistent.
+     */
+    bool LoadUnitVectors(o3d3xx::UnitVectors& msg) const
+    {
+      return MetadataCache::LoadUnitVectorsFile(
+	       this->dir_ + "/unit_vectors.bin", msg);
+    }
+
+    /**
+     * Like `LoadUnitVectors', from the unit vector file at `path', e.g., one
+     * a camera saved in its cache directory, for a node that has no camera
+     */
+    static bool LoadUnitVectorsFile(const std::string& path,
+				    o3d3xx::UnitVectors& msg)
+    {
+      std::ifstream in(path, std::ios::in | std::ios::binary);
+      metadata::UnitVectorsHeader hdr;
+      if ((! in.read(reinterpret_cast<char*>(&hdr), sizeof(hdr))) ||
+	  (std::memcmp(hdr.magic, metadata::UNIT_VECTORS_MAGIC,
+		       sizeof(hdr.magic)) != 0) ||
+	  (hdr.height > metadata::MAX_SIDE) || (hdr.width > metadata::MAX_SIDE))
+	{
+	  return false;
+	}
+
+      std::size_t n = static_cast<std::size_t>(hdr.height) * hdr.width;
+      msg.height = hdr.height;
+      msg.width = hdr.width;
+      for (int i = 0; i < 3; ++i)
+	{
+	  msg.origin[i] = hdr.origin[i];
+	}
+      msg.complete = hdr.complete != 0;
+      msg.x.resize(n);
+      msg.y.resize(n);
+      msg.z.resize(n);
+
+      std::streamsize bytes = n * sizeof(float);
+      return in.read(reinterpret_cast<char*>(msg.x.data()), bytes) &&
+	in.read(reinterpret_cast<char*>(msg.y.data()), bytes) &&
+	in.read(reinterpret_cast<char*>(msg.z.data()), bytes);
+    }
+
+    void SaveUnitVectors(const o3d3xx::UnitVectors& msg) const
+    {
+      std::size_t n = static_cast<std::size_t>(msg.height) * msg.width;
+      if ((msg.x.size() != n) || (msg.y.size() != n) || (msg.z.size() != n))
+	{
+	  throw std::runtime_error("Inconsistent unit vectors");
+	}
+
+      metadata::UnitVectorsHeader hdr;
+      std::memcpy(hdr.magic, metadata::UNIT_VECTORS_MAGIC, sizeof(hdr.magic));
+      hdr.height = msg.height;
+      hdr.width = msg.width;
+      for (int i = 0; i < 3; ++i)
+	{
+	  hdr.origin[i] = msg.origin[i];
+	}
+      hdr.complete = msg.complete ? 1 : 0;
+
+      std::vector<float> planes;
+      planes.reserve(3 * n);
+      planes.insert(planes.end(), msg.x.begin(), msg.x.end());
+      planes.insert(planes.end(), msg.y.begin(), msg.y.end());
+      planes.insert(planes.end(), msg.z.begin(), msg.z.end());
+
+      this->Save("unit_vectors.bin", &hdr, sizeof(hdr), planes.data(),
+		 planes.size() * sizeof(float));
+    }
+
+  private:
+    /**
+     * Replaces file `name' with `head' followed by `body'
+     */
+    void Save(const std::string& name, const void* head, std::size_t head_len,
+	      const void* body, std::size_t body_len) const
+    {
+      std::string path = this->dir_ + "/" + name;
+      std::string tmp = path + ".tmp";
+
+      {
+	std::ofstream out(tmp, std::ios::out | std::ios::binary |
+			  std::ios::trunc);
+	out.write(static_cast<const char*>(head), head_len);
+	if (body_len > 0)
+	  {
+	    out.write(static_cast<const char*>(body), body_len);
+	  }
+	out.close();
+	if (! out)
+	  {
+	    std::remove(tmp.c_str());
+	    throw std::runtime_error("Failed to write cache file: " + tmp);
+	  }
+      }
+
+      if (std::rename(tmp.c_str(), path.c_str()) != 0)
+	{
+	  std::remove(tmp.c_str());
+	  throw std::runtime_error("Failed to replace cache file: " + path);
+	}
+    }
+
+    std::string dir_;
+
+  }; // end: class MetadataCache
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_METADATA_CACHE_H__
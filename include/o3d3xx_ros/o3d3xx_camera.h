@@ -0,0 +1,1898 @@
+/*
+ * Copyright (C) 2014 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_O3D3XX_CAMERA_H__
+#define __O3D3XX_ROS_O3D3XX_CAMERA_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <image_transport/image_transport.h>
+#include <o3d3xx.h>
+#include <opencv2/opencv.hpp>
+#include <pcl_ros/point_cloud.h>
+#include <ros/callback_queue.h>
+#include <ros/ros.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <o3d3xx/Config.h>
+#include <o3d3xx/ConnectionState.h>
+#include <o3d3xx/Dump.h>
+#include <o3d3xx/Frame.h>
+#include <o3d3xx/PackedImage.h>
+#include <o3d3xx/Rm.h>
+#include <o3d3xx/SetActiveApp.h>
+#include <o3d3xx/UnitVectors.h>
+#include <o3d3xx_ros/bounded_queue.h>
+#include <o3d3xx_ros/change_detector.h>
+#include <o3d3xx_ros/cloud_filter.h>
+#include <o3d3xx_ros/config_diff.h>
+#include <o3d3xx_ros/image_pool.h>
+#include <o3d3xx_ros/message_pool.h>
+#include <o3d3xx_ros/metadata_cache.h>
+#include <o3d3xx_ros/point_cloud2.h>
+#include <o3d3xx_ros/rate_limiter.h>
+#include <o3d3xx_ros/rvl.h>
+#include <o3d3xx_ros/stage_stats.h>
+#include <o3d3xx_ros/temporal_filter.h>
+#include <o3d3xx_ros/thread_config.h>
+#include <o3d3xx_ros/timestamp.h>
+#include <o3d3xx_ros/unit_vectors.h>
+#include <o3d3xx_ros/viz.h>
+
+/**
+ * Everything the driver does on behalf of one physical camera: the
+ * connection to it, its published topics and its configuration services.
+ *
+ * The threads that pull frames from the camera and publish them are owned by
+ * `O3D3xxNode', which may drive several of these.
+ *
+ * Constructing a camera never talks to it: the frame grabber connects on a
+ * thread of its own, and the services, which do talk to the camera, only
+ * come up with `StartServices', so streaming is not held up by them. With
+ * `cache_dir' set, what is slow to get from the camera -- the
+ * configuration dump and the unit vectors -- is kept on disk and is
+ * available right away on the next run.
+ */
+class O3D3xxCamera
+{
+public:
+  /**
+   * State a publishing thread keeps, per camera, between frames: the
+   * recycled outgoing messages and scratch images.
+   */
+  struct Scratch
+  {
+    o3d3xx_ros::ImagePool depth_pool;
+    o3d3xx_ros::ImagePool amplitude_pool;
+    o3d3xx_ros::ImagePool conf_pool;
+    o3d3xx_ros::ImagePool depth_viz_pool;
+    o3d3xx_ros::ImagePool good_bad_pool;
+    o3d3xx_ros::ImagePool hist_pool;
+    o3d3xx_ros::MessagePool<o3d3xx::Frame> frame_pool;
+    o3d3xx_ros::MessagePool<pcl::PointCloud<o3d3xx::PointT> > cloud_pool;
+    o3d3xx_ros::MessagePool<sensor_msgs::PointCloud2> cloud2_pool;
+    o3d3xx_ros::MessagePool<o3d3xx::PackedImage> depth_rvl_pool;
+    o3d3xx_ros::MessagePool<o3d3xx::PackedImage> amplitude_rvl_pool;
+    pcl::PointCloud<o3d3xx::PointT> filter_cloud;
+    o3d3xx_ros::VizRenderer viz;
+  };
+
+  /**
+   * If `name' is empty, the camera's parameters are read from `nh' and its
+   * topics and services get the global names the single camera driver has
+   * always used (`/cloud', `/Config', ...) so they can be remapped. Otherwise
+   * everything lives in the `name' child namespace of `nh', and any of
+   * `timeout_millis', `publish_viz_images', `cloud_encoding', `config_diff',
+   * `rvl_mask_invalid', `service_cpus', `cache_dir', the stamp, cloud
+   * filter, temporal filter, rate and change detection parameters not set
+   * there are inherited from `nh'.
+   *
+   * `free_buffers' is how many image buffers to keep around for reuse.
+   */
+  O3D3xxCamera(ros::NodeHandle nh, const std::string& name,
+	       std::size_t free_buffers)
+    : timeout_millis_(500),
+      publish_viz_images_(false),
+      camera_stamps_(false),
+      camera_stamps_warned_(false),
+      stamp_offset_(0.0),
+      fg_generation_(0),
+      frame_generation_(0),
+      reconnect_timeouts_(3),
+      reconnect_max_backoff_(5.0),
+      state_(o3d3xx::ConnectionState::CONNECTING),
+      consecutive_timeouts_(0),
+      reconnect_attempts_(0),
+      backoff_millis_(500),
+      last_frame_at_(std::chrono::steady_clock::now()),
+      config_cache_valid_(false),
+      config_cache_checked_(false),
+      config_diff_(true),
+      rvl_mask_invalid_(true),
+      adaptive_rate_(false),
+      min_rate_(1.0),
+      input_rate_(0.0),
+      received_frames_(0),
+      timeouts_(0),
+      dropped_frames_(0),
+      published_frames_(0),
+      static_frames_(0),
+      last_received_(0),
+      last_timeouts_(0),
+      last_dropped_(0),
+      last_report_(std::chrono::steady_clock::now()),
+      started_at_(std::chrono::steady_clock::now()),
+      first_frame_secs_(-1.0),
+      temporal_max_gap_(1.0),
+      cloud_encoding_(o3d3xx_ros::cloud_encoding::PCL),
+      unit_vectors_complete_(false),
+      unit_vectors_published_(false)
+  {
+    std::string camera_ip;
+    int xmlrpc_port;
+    std::string password;
+    int timeout_millis;
+    bool publish_viz_images;
+    std::string stamp_source;
+    double stamp_offset;
+    bool filter_confidence;
+    std::vector<double> roi_min, roi_max;
+    double voxel_size;
+    std::string cloud_encoding;
+    bool config_diff;
+    bool rvl_mask_invalid;
+    double max_rate;
+    bool adaptive_rate;
+    double min_rate;
+    int reconnect_timeouts;
+    double reconnect_max_backoff;
+    bool change_detection;
+    int change_tolerance;
+    int change_min_pixels;
+    double heartbeat_period;
+    std::string temporal_filter;
+    double temporal_alpha;
+    int temporal_window;
+    int temporal_reset;
+    double temporal_max_gap;
+    std::string cache_dir;
+
+    nh.param("timeout_millis", timeout_millis, 500);
+    nh.param("publish_viz_images", publish_viz_images, false);
+    nh.param("stamp_source", stamp_source, std::string("host"));
+    nh.param("stamp_offset", stamp_offset, 0.0);
+    nh.param("filter_confidence", filter_confidence, false);
+    nh.param("roi_min", roi_min, std::vector<double>());
+    nh.param("roi_max", roi_max, std::vector<double>());
+    nh.param("voxel_size", voxel_size, 0.0);
+    nh.param("cloud_encoding", cloud_encoding, std::string("pcl"));
+    nh.param("config_diff", config_diff, true);
+    nh.param("rvl_mask_invalid", rvl_mask_invalid, true);
+    nh.param("max_rate", max_rate, 0.0);
+    nh.param("adaptive_rate", adaptive_rate, false);
+    nh.param("min_rate", min_rate, 1.0);
+    nh.param("reconnect_timeouts", reconnect_timeouts, 3);
+    nh.param("reconnect_max_backoff", reconnect_max_backoff, 5.0);
+    nh.param("change_detection", change_detection, false);
+    nh.param("change_tolerance", change_tolerance, 20);
+    nh.param("change_min_pixels", change_min_pixels, 50);
+    nh.param("heartbeat_period", heartbeat_period, 10.0);
+    nh.param("temporal_filter", temporal_filter, std::string("none"));
+    nh.param("temporal_alpha", temporal_alpha, 0.3);
+    nh.param("temporal_window", temporal_window, 5);
+    nh.param("temporal_reset", temporal_reset, 100);
+    nh.param("temporal_max_gap", temporal_max_gap, 1.0);
+    nh.param("service_cpus", this->service_cpus_, std::vector<int>());
+    nh.param("cache_dir", cache_dir, std::string(""));
+
+    ros::NodeHandle cam_nh = name.empty() ? nh : ros::NodeHandle(nh, name);
+    std::string prefix = name.empty() ? "/" : "";
+
+    cam_nh.param("ip", camera_ip, o3d3xx::DEFAULT_IP);
+    cam_nh.param("xmlrpc_port", xmlrpc_port,
+		 (int) o3d3xx::DEFAULT_XMLRPC_PORT);
+    cam_nh.param("password", password, o3d3xx::DEFAULT_PASSWORD);
+    this->xmlrpc_port_ = xmlrpc_port;
+    this->password_ = password;
+    cam_nh.param("timeout_millis", this->timeout_millis_, timeout_millis);
+    cam_nh.param("publish_viz_images", this->publish_viz_images_,
+		 publish_viz_images);
+    cam_nh.param("frame_id", this->frame_id_,
+		 cam_nh.getNamespace() + "_link");
+    cam_nh.param("stamp_source", stamp_source, stamp_source);
+    cam_nh.param("stamp_offset", this->stamp_offset_, stamp_offset);
+    cam_nh.param("filter_confidence", filter_confidence, filter_confidence);
+    cam_nh.param("roi_min", roi_min, roi_min);
+    cam_nh.param("roi_max", roi_max, roi_max);
+    cam_nh.param("voxel_size", voxel_size, voxel_size);
+    cam_nh.param("cloud_encoding", cloud_encoding, cloud_encoding);
+    this->cloud_encoding_ = o3d3xx_ros::ParseCloudEncoding(cloud_encoding);
+    cam_nh.param("config_diff", this->config_diff_, config_diff);
+    cam_nh.param("rvl_mask_invalid", this->rvl_mask_invalid_,
+		 rvl_mask_invalid);
+    cam_nh.param("max_rate", max_rate, max_rate);
+    cam_nh.param("adaptive_rate", this->adaptive_rate_, adaptive_rate);
+    cam_nh.param("min_rate", this->min_rate_, min_rate);
+    cam_nh.param("reconnect_timeouts", this->reconnect_timeouts_,
+		 reconnect_timeouts);
+    cam_nh.param("reconnect_max_backoff", this->reconnect_max_backoff_,
+		 reconnect_max_backoff);
+    cam_nh.param("change_detection", change_detection, change_detection);
+    cam_nh.param("change_tolerance", change_tolerance, change_tolerance);
+    cam_nh.param("change_min_pixels", change_min_pixels, change_min_pixels);
+    cam_nh.param("heartbeat_period", heartbeat_period, heartbeat_period);
+    cam_nh.param("temporal_filter", temporal_filter, temporal_filter);
+    cam_nh.param("temporal_alpha", temporal_alpha, temporal_alpha);
+    cam_nh.param("temporal_window", temporal_window, temporal_window);
+    cam_nh.param("temporal_reset", temporal_reset, temporal_reset);
+    cam_nh.param("temporal_max_gap", this->temporal_max_gap_,
+		 temporal_max_gap);
+    cam_nh.param("service_cpus", this->service_cpus_, this->service_cpus_);
+    o3d3xx_ros::CheckCpus(this->service_cpus_, "service_cpus");
+    cam_nh.param("cache_dir", cache_dir, cache_dir);
+
+    // `<topic>_max_rate' overrides `max_rate' for one topic
+    auto topic_rate = [&](const std::string& topic) -> double
+      {
+	double rate = max_rate;
+	nh.param(topic + "_max_rate", rate, rate);
+	cam_nh.param(topic + "_max_rate", rate, rate);
+	return rate;
+      };
+
+    this->cloud_rate_.SetRate(topic_rate("cloud"));
+    this->depth_rate_.SetRate(topic_rate("depth"));
+    this->depth_rvl_rate_.SetRate(topic_rate("depth_rvl"));
+    this->depth_viz_rate_.SetRate(topic_rate("depth_viz"));
+    this->amplitude_rate_.SetRate(topic_rate("amplitude"));
+    this->amplitude_rvl_rate_.SetRate(topic_rate("amplitude_rvl"));
+    this->conf_rate_.SetRate(topic_rate("confidence"));
+    this->good_bad_rate_.SetRate(topic_rate("good_bad_pixels"));
+    this->hist_rate_.SetRate(topic_rate("hist"));
+    this->frame_rate_.SetRate(topic_rate("frame"));
+
+    if (this->min_rate_ <= 0.0)
+      {
+	throw std::runtime_error("min_rate must be positive");
+      }
+
+    if (change_detection)
+      {
+	this->change_detector_.reset(
+	  new o3d3xx_ros::ChangeDetector(change_tolerance, change_min_pixels,
+					 heartbeat_period));
+      }
+
+    this->filter_.reset(
+      new o3d3xx_ros::CloudFilter(filter_confidence, roi_min, roi_max,
+				  voxel_size));
+
+    this->temporal_filter_.reset(
+      new o3d3xx_ros::TemporalFilter(
+	o3d3xx_ros::ParseTemporalMode(temporal_filter), temporal_alpha,
+	temporal_window, temporal_reset));
+
+    if (this->temporal_max_gap_ < 0.0)
+      {
+	throw std::runtime_error("temporal_max_gap must not be negative");
+      }
+
+    if (stamp_source == "camera")
+      {
+	this->camera_stamps_ = true;
+      }
+    else if (stamp_source != "host")
+      {
+	throw std::runtime_error("Invalid stamp_source: " + stamp_source);
+      }
+
+    this->name_ = cam_nh.getNamespace();
+    this->ip_ = camera_ip;
+
+    //-----------------------------------------
+    // Instantiate the camera and frame-grabber
+    //-----------------------------------------
+    this->cam_ =
+      std::make_shared<o3d3xx::Camera>(camera_ip, xmlrpc_port, password);
+
+    this->fg_ =
+      std::make_shared<o3d3xx::FrameGrabber>(this->cam_);
+
+    this->free_buffers_.reset(
+      new o3d3xx_ros::BoundedQueue<o3d3xx::ImageBuffer::Ptr>(free_buffers));
+
+    //----------------------
+    // Published topics
+    //----------------------
+    if (this->cloud_encoding_ == o3d3xx_ros::cloud_encoding::PCL)
+      {
+	this->cloud_pub_ =
+	  cam_nh.advertise<pcl::PointCloud<o3d3xx::PointT> >
+	  (prefix + "cloud", 1);
+      }
+    else
+      {
+	this->cloud_pub_ =
+	  cam_nh.advertise<sensor_msgs::PointCloud2>(prefix + "cloud", 1);
+      }
+
+    image_transport::ImageTransport it(cam_nh);
+    this->depth_pub_ = it.advertise(prefix + "depth", 1);
+    this->depth_viz_pub_ = it.advertise(prefix + "depth_viz", 1);
+    this->amplitude_pub_ = it.advertise(prefix + "amplitude", 1);
+    this->conf_pub_ = it.advertise(prefix + "confidence", 1);
+    this->good_bad_pub_ = it.advertise(prefix + "good_bad_pixels", 1);
+    this->hist_pub_ = it.advertise(prefix + "hist", 1);
+
+    this->frame_pub_ = cam_nh.advertise<o3d3xx::Frame>(prefix + "frame", 1);
+
+    // latched, so late subscribers learn the current state
+    this->state_pub_ =
+      cam_nh.advertise<o3d3xx::ConnectionState>(prefix + "connection_state",
+						1, true);
+    this->PublishState();
+
+    // latched, learned once from the first frames after a subscriber shows
+    this->unit_vectors_pub_ =
+      cam_nh.advertise<o3d3xx::UnitVectors>(prefix + "unit_vectors", 1, true);
+
+    this->depth_rvl_pub_ =
+      cam_nh.advertise<o3d3xx::PackedImage>(prefix + "depth_rvl", 1);
+    this->amplitude_rvl_pub_ =
+      cam_nh.advertise<o3d3xx::PackedImage>(prefix + "amplitude_rvl", 1);
+
+    //----------------------
+    // Cached metadata
+    //----------------------
+    if (! cache_dir.empty())
+      {
+	this->LoadCache(cache_dir);
+      }
+
+    this->srv_nh_ = cam_nh;
+    this->srv_nh_.setCallbackQueue(&this->service_queue_);
+    this->srv_prefix_ = prefix;
+  }
+
+  ~O3D3xxCamera()
+  {
+    if (this->service_spinner_)
+      {
+	this->service_spinner_->stop();
+      }
+  }
+
+  /**
+   * Advertises the services and starts the thread serving them, once.
+   *
+   * They are serviced by a thread of their own: they talk XMLRPC to the
+   * camera and may take seconds, which must hold up neither other cameras
+   * nor, when running as a nodelet, the manager's callback threads. The
+   * thread runs on `service_cpus'.
+   */
+  void StartServices()
+  {
+    if (this->service_spinner_)
+      {
+	return;
+      }
+
+    ros::NodeHandle& srv_nh = this->srv_nh_;
+    const std::string& prefix = this->srv_prefix_;
+
+    this->dump_srv_ =
+      srv_nh.advertiseService<o3d3xx::Dump::Request, o3d3xx::Dump::Response>
+      (prefix + "Dump", std::bind(&O3D3xxCamera::Dump, this,
+				  std::placeholders::_1,
+				  std::placeholders::_2));
+
+    this->config_srv_ =
+      srv_nh.advertiseService<o3d3xx::Config::Request,
+			      o3d3xx::Config::Response>
+      (prefix + "Config", std::bind(&O3D3xxCamera::Config, this,
+				    std::placeholders::_1,
+				    std::placeholders::_2));
+
+    this->rm_srv_ =
+      srv_nh.advertiseService<o3d3xx::Rm::Request, o3d3xx::Rm::Response>
+      (prefix + "Rm", std::bind(&O3D3xxCamera::Rm, this,
+				std::placeholders::_1,
+				std::placeholders::_2));
+
+    this->set_active_app_srv_ =
+      srv_nh.advertiseService<o3d3xx::SetActiveApp::Request,
+			      o3d3xx::SetActiveApp::Response>
+      (prefix + "SetActiveApp", std::bind(&O3D3xxCamera::SetActiveApp, this,
+					  std::placeholders::_1,
+					  std::placeholders::_2));
+
+    this->service_spinner_.reset(
+      new ros::AsyncSpinner(1, &this->service_queue_));
+    {
+      // the spinner's thread inherits the affinity
+      o3d3xx_ros::ScopedAffinity pin(this->service_cpus_);
+      this->service_spinner_->start();
+    }
+  }
+
+  /**
+   * Fully resolved namespace of this camera, for log messages.
+   */
+  const std::string& Name() const
+  {
+    return this->name_;
+  }
+
+  /**
+   * Returns a buffer to acquire into. It is taken from the free list when
+   * possible so steady state does not allocate.
+   */
+  o3d3xx::ImageBuffer::Ptr GetBuffer()
+  {
+    o3d3xx::ImageBuffer::Ptr buff;
+    if (! this->free_buffers_->TryPop(buff))
+      {
+	buff = std::make_shared<o3d3xx::ImageBuffer>();
+      }
+
+    return buff;
+  }
+
+  /**
+   * Blocks for up to `timeout_millis' for the next frame from the camera.
+   *
+   * On success, `stamp' is set to the time the frame was taken: either the
+   * time it was received, or the camera's own time stamp translated to the
+   * host clock (`stamp_source'), less `stamp_offset' seconds. The stamp is
+   * rounded to whole microseconds so that the point cloud, whose PCL header
+   * only has microsecond resolution, carries the exact same stamp as the
+   * images.
+   *
+   * The services may swap in a new frame grabber meanwhile; the wait
+   * finishes on the one it started with.
+   *
+   * After `reconnect_timeouts' timeouts in a row, the camera is considered
+   * gone and the frame grabber, and the camera, are recreated. Until a
+   * frame comes in again every further attempt waits twice as long for it,
+   * starting at `timeout_millis' and up to `reconnect_max_backoff' seconds.
+   * Changes of state are published on `connection_state'.
+   *
+   * This must only be called from a single thread.
+   */
+  bool WaitForFrame(o3d3xx::ImageBuffer* buff, ros::Time& stamp)
+  {
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+    o3d3xx::FrameGrabber::Ptr fg;
+    std::uint64_t generation;
+    {
+      std::lock_guard<std::mutex> lock(this->fg_mutex_);
+      fg = this->fg_;
+      generation = this->fg_generation_;
+    }
+
+    int wait_millis =
+      this->state_ == o3d3xx::ConnectionState::RECONNECTING ?
+      this->backoff_millis_ : this->timeout_millis_;
+
+    if (! fg->WaitForFrame(buff, wait_millis))
+      {
+	this->timeouts_++;
+	this->TimedOut();
+	return false;
+      }
+
+    this->frame_generation_ = generation;
+    this->received_frames_++;
+    this->FrameReceived();
+
+    std::chrono::steady_clock::time_point received =
+      std::chrono::steady_clock::now();
+    this->acquire_stats_.Record(received - start);
+
+    // smoothed rate the camera delivers at, what back-off recovers to
+    if (this->last_received_at_ != std::chrono::steady_clock::time_point())
+      {
+	double interval = std::chrono::duration<double>(
+	  received - this->last_received_at_).count();
+	if (interval > 0.0)
+	  {
+	    double rate = this->input_rate_;
+	    this->input_rate_ = rate > 0.0 ?
+	      0.9 * rate + 0.1 / interval : 1.0 / interval;
+	  }
+      }
+    this->last_received_at_ = received;
+
+    ros::Time now = ros::Time::now();
+    stamp = now;
+
+    if (this->camera_stamps_)
+      {
+	ros::Time device_stamp;
+	if (o3d3xx_ros::ChunkTimestamp(buff->Bytes(), device_stamp))
+	  {
+	    stamp = this->clock_offset_.Translate(device_stamp, now);
+	  }
+	else if (! this->camera_stamps_warned_)
+	  {
+	    ROS_WARN("Camera does not provide frame time stamps, "
+		     "using the host clock (%s)", this->name_.c_str());
+	    this->camera_stamps_warned_ = true;
+	  }
+      }
+
+    std::int64_t nsec = (std::int64_t) stamp.toNSec() -
+      (std::int64_t) (this->stamp_offset_ * 1e9);
+    stamp.fromNSec((std::max<std::int64_t>(nsec, 0) / 1000) * 1000);
+    return true;
+  }
+
+  /**
+   * Whether the frame in `buff', stamped `stamp', would be published on any
+   * topic, given the subscribers and the rate limits and, with
+   * `change_detection', whether the scene changed since the last frame
+   * published. Frames that would not be can be discarded before they are
+   * converted.
+   *
+   * With `temporal_filter', the depth and cloud of every frame received are
+   * filtered here, in place and in order, before the rate limits and the
+   * change detection look at them, so the history does not depend on how
+   * many frames are published. That costs a filter pass on frames that are
+   * then discarded, which is small next to parsing them. The history starts
+   * over when the stamps of two frames are more than `temporal_max_gap'
+   * seconds apart. `adaptive_rate' comes after the change detection, so
+   * only frames that would otherwise be published use up its budget.
+   *
+   * This must only be called from the acquisition thread; frames it
+   * returns true for must be handed to `Publish'.
+   */
+  bool Wanted(const o3d3xx::ImageBuffer::Ptr& buff, const ros::Time& stamp)
+  {
+    if (this->temporal_filter_->Enabled())
+      {
+	std::chrono::steady_clock::time_point start =
+	  std::chrono::steady_clock::now();
+
+	// no frames for a while, or the clock went back: the scene the
+	// history describes may be gone
+	double gap = (stamp - this->temporal_stamp_).toSec();
+	if ((! this->temporal_stamp_.isZero()) &&
+	    (this->temporal_max_gap_ > 0.0) &&
+	    ((gap > this->temporal_max_gap_) || (gap < 0.0)))
+	  {
+	    this->temporal_filter_->Restart();
+	  }
+	this->temporal_stamp_ = stamp;
+
+	cv::Mat depth = buff->DepthImage();
+	this->temporal_filter_->Apply(depth, buff->ConfidenceImage(),
+				      *buff->Cloud());
+	this->filter_stats_.Record(std::chrono::steady_clock::now() - start);
+      }
+
+    bool wanted =
+      O3D3xxCamera::Wants(this->cloud_pub_, this->cloud_rate_, stamp) ||
+      O3D3xxCamera::Wants(this->depth_pub_, this->depth_rate_, stamp) ||
+      O3D3xxCamera::Wants(this->depth_rvl_pub_, this->depth_rvl_rate_,
+			  stamp) ||
+      O3D3xxCamera::Wants(this->amplitude_pub_, this->amplitude_rate_,
+			  stamp) ||
+      O3D3xxCamera::Wants(this->amplitude_rvl_pub_, this->amplitude_rvl_rate_,
+			  stamp) ||
+      O3D3xxCamera::Wants(this->conf_pub_, this->conf_rate_, stamp) ||
+      O3D3xxCamera::Wants(this->frame_pub_, this->frame_rate_, stamp) ||
+      ((this->unit_vectors_pub_.getNumSubscribers() > 0) &&
+       (! this->unit_vectors_complete_)) ||
+      (this->publish_viz_images_ &&
+       (O3D3xxCamera::Wants(this->depth_viz_pub_, this->depth_viz_rate_,
+			    stamp) ||
+	O3D3xxCamera::Wants(this->good_bad_pub_, this->good_bad_rate_,
+			    stamp) ||
+	O3D3xxCamera::Wants(this->hist_pub_, this->hist_rate_, stamp)));
+
+    if (! wanted)
+      {
+	return false;
+      }
+
+    if (this->change_detector_ &&
+	(! this->change_detector_->Changed(buff->DepthImage(),
+					   buff->ConfidenceImage(), stamp)))
+      {
+	this->static_frames_++;
+	return false;
+      }
+
+    // after change detection, so static frames do not use up the budget
+    if (this->adaptive_rate_)
+      {
+	this->Recover();
+	if (! this->backoff_rate_.Take(stamp))
+	  {
+	    return false;
+	  }
+      }
+
+    // last, so only frames that go out become the reference
+    if (this->change_detector_)
+      {
+	this->change_detector_->Accept(buff->DepthImage(),
+				       buff->ConfidenceImage(), stamp);
+      }
+
+    return true;
+  }
+
+  /**
+   * Returns `buff' to the free list, unless an intra-process subscriber
+   * still holds data we published out of it, and resets it.
+   */
+  void Recycle(o3d3xx::ImageBuffer::Ptr& buff)
+  {
+    if (buff && (buff.use_count() == 1))
+      {
+	this->free_buffers_->TryPush(buff);
+      }
+
+    buff.reset();
+  }
+
+  /**
+   * Records that a frame from this camera was discarded because publishing
+   * is not keeping up.
+   */
+  void FrameDropped()
+  {
+    std::uint64_t dropped = ++this->dropped_frames_;
+    ROS_WARN_THROTTLE(5.0,
+      "Publishing is not keeping up with the camera, "
+      "%lu frames dropped (%s)", (unsigned long) dropped,
+      this->name_.c_str());
+
+    if (this->adaptive_rate_)
+      {
+	this->BackOff();
+      }
+  }
+
+  /**
+   * Converts `buff' and publishes it on the topics that have subscribers.
+   * Everything published carries the same `stamp'.
+   */
+  void Publish(const o3d3xx::ImageBuffer::Ptr& buff, const ros::Time& stamp,
+	       Scratch& scratch)
+  {
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+    // time spent handing messages to the subscribers, which is reported
+    // apart from the conversion it is interleaved with
+    std::chrono::steady_clock::duration published =
+      std::chrono::steady_clock::duration::zero();
+
+    // Only do the work for the topics somebody is listening to
+    if ((this->cloud_pub_.getNumSubscribers() > 0) &&
+	this->cloud_rate_.Take(stamp))
+      {
+	pcl::PointCloud<o3d3xx::PointT>::Ptr cloud;
+	if (this->filter_->Enabled())
+	  {
+	    cloud = scratch.cloud_pool.Get();
+	    this->filter_->Apply(*buff->Cloud(), buff->ConfidenceImage(),
+				 *cloud, scratch.filter_cloud);
+	  }
+	else
+	  {
+	    cloud = this->WrapCloud(buff);
+	  }
+
+	if (this->cloud_encoding_ == o3d3xx_ros::cloud_encoding::PCL)
+	  {
+	    cloud->header.frame_id = this->frame_id_;
+	    cloud->header.stamp = stamp.toNSec() / 1000;
+	    O3D3xxCamera::Send(this->cloud_pub_, cloud, published);
+	  }
+	else
+	  {
+	    sensor_msgs::PointCloud2Ptr msg = scratch.cloud2_pool.Get();
+	    o3d3xx_ros::PackCloud(*cloud, this->cloud_encoding_, *msg);
+	    msg->header.frame_id = this->frame_id_;
+	    msg->header.stamp = stamp;
+	    O3D3xxCamera::Send(this->cloud_pub_, msg, published);
+	  }
+      }
+
+    if ((this->depth_pub_.getNumSubscribers() > 0) &&
+	this->depth_rate_.Take(stamp))
+      {
+	sensor_msgs::ImagePtr depth =
+	  scratch.depth_pool.Get(buff->DepthImage(), "mono16");
+	depth->header.frame_id = this->frame_id_;
+	depth->header.stamp = stamp;
+	O3D3xxCamera::Send(this->depth_pub_, depth, published);
+      }
+
+    if ((this->amplitude_pub_.getNumSubscribers() > 0) &&
+	this->amplitude_rate_.Take(stamp))
+      {
+	sensor_msgs::ImagePtr amplitude =
+	  scratch.amplitude_pool.Get(buff->AmplitudeImage(), "mono16");
+	amplitude->header.frame_id = this->frame_id_;
+	amplitude->header.stamp = stamp;
+	O3D3xxCamera::Send(this->amplitude_pub_, amplitude, published);
+      }
+
+    if ((this->depth_rvl_pub_.getNumSubscribers() > 0) &&
+	this->depth_rvl_rate_.Take(stamp))
+      {
+	o3d3xx::PackedImagePtr depth = scratch.depth_rvl_pool.Get();
+	this->Pack(buff->DepthImage(), buff->ConfidenceImage(), *depth);
+	depth->header.frame_id = this->frame_id_;
+	depth->header.stamp = stamp;
+	O3D3xxCamera::Send(this->depth_rvl_pub_, depth, published);
+      }
+
+    if ((this->amplitude_rvl_pub_.getNumSubscribers() > 0) &&
+	this->amplitude_rvl_rate_.Take(stamp))
+      {
+	o3d3xx::PackedImagePtr amplitude = scratch.amplitude_rvl_pool.Get();
+	this->Pack(buff->AmplitudeImage(), buff->ConfidenceImage(),
+		   *amplitude);
+	amplitude->header.frame_id = this->frame_id_;
+	amplitude->header.stamp = stamp;
+	O3D3xxCamera::Send(this->amplitude_rvl_pub_, amplitude, published);
+      }
+
+    if ((this->conf_pub_.getNumSubscribers() > 0) &&
+	this->conf_rate_.Take(stamp))
+      {
+	sensor_msgs::ImagePtr confidence =
+	  scratch.conf_pool.Get(buff->ConfidenceImage(), "mono8");
+	confidence->header.frame_id = this->frame_id_;
+	confidence->header.stamp = stamp;
+	O3D3xxCamera::Send(this->conf_pub_, confidence, published);
+      }
+
+    if ((this->frame_pub_.getNumSubscribers() > 0) &&
+	this->frame_rate_.Take(stamp))
+      {
+	o3d3xx::FramePtr frame = scratch.frame_pool.Get();
+	O3D3xxCamera::FillFrame(buff, *frame);
+	frame->header.frame_id = this->frame_id_;
+	frame->header.stamp = stamp;
+	O3D3xxCamera::Send(this->frame_pub_, frame, published);
+      }
+
+    if ((this->unit_vectors_pub_.getNumSubscribers() > 0) &&
+	(! this->unit_vectors_complete_))
+      {
+	this->LearnUnitVectors(buff, stamp, published);
+      }
+
+    std::chrono::steady_clock::time_point converted =
+      std::chrono::steady_clock::now();
+    this->convert_stats_.Record(converted - start - published);
+    this->published_frames_++;
+
+    if (! this->publish_viz_images_)
+      {
+	this->publish_stats_.Record(published);
+	return;
+      }
+
+    cv::Mat depth = buff->DepthImage();
+    sensor_msgs::ImagePtr depth_viz, good_bad, hist;
+    cv::Mat depth_viz_map, good_bad_map, hist_map;
+
+    if ((this->depth_viz_pub_.getNumSubscribers() > 0) &&
+	this->depth_viz_rate_.Take(stamp))
+      {
+	// depth image with better colormap
+	depth_viz = scratch.depth_viz_pool.Get(depth.rows, depth.cols,
+					       CV_8UC3, "bgr8");
+	depth_viz_map = o3d3xx_ros::ImagePool::Wrap(depth_viz, CV_8UC3);
+      }
+
+    if ((this->good_bad_pub_.getNumSubscribers() > 0) &&
+	this->good_bad_rate_.Take(stamp))
+      {
+	// show good vs bad pixels as binary image
+	good_bad = scratch.good_bad_pool.Get(depth.rows, depth.cols,
+					     CV_8UC1, "mono8");
+	good_bad_map = o3d3xx_ros::ImagePool::Wrap(good_bad, CV_8UC1);
+      }
+
+    if ((this->hist_pub_.getNumSubscribers() > 0) &&
+	this->hist_rate_.Take(stamp))
+      {
+	// histogram of amplitude image
+	hist = scratch.hist_pool.Get(o3d3xx_ros::VizRenderer::HIST_ROWS,
+				     o3d3xx_ros::VizRenderer::HIST_COLS,
+				     CV_8UC3, "bgr8");
+	hist_map = o3d3xx_ros::ImagePool::Wrap(hist, CV_8UC3);
+      }
+
+    if (! (depth_viz || good_bad || hist))
+      {
+	this->publish_stats_.Record(published);
+	return;
+      }
+
+    scratch.viz.Render(depth, buff->AmplitudeImage(), buff->ConfidenceImage(),
+		       depth_viz ? &depth_viz_map : nullptr,
+		       good_bad ? &good_bad_map : nullptr,
+		       hist ? &hist_map : nullptr);
+    this->viz_stats_.Record(std::chrono::steady_clock::now() - converted);
+
+    for (auto& msg : {depth_viz, good_bad, hist})
+      {
+	if (msg)
+	  {
+	    msg->header.frame_id = this->frame_id_;
+	    msg->header.stamp = stamp;
+	  }
+      }
+
+    if (depth_viz)
+      {
+	O3D3xxCamera::Send(this->depth_viz_pub_, depth_viz, published);
+      }
+
+    if (good_bad)
+      {
+	O3D3xxCamera::Send(this->good_bad_pub_, good_bad, published);
+      }
+
+    if (hist)
+      {
+	O3D3xxCamera::Send(this->hist_pub_, hist, published);
+      }
+
+    this->publish_stats_.Record(published);
+  }
+
+  /**
+   * Diagnostic task reporting the frame rate, timeouts, dropped frames and
+   * per-stage timings of this camera. Warns if frames timed out or were
+   * dropped since the last report, errors if none came in at all.
+   *
+   * This must only be called from a single thread.
+   */
+  void Diagnose(diagnostic_updater::DiagnosticStatusWrapper& stat)
+  {
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    std::uint64_t received = this->received_frames_;
+    std::uint64_t timeouts = this->timeouts_;
+    std::uint64_t dropped = this->dropped_frames_;
+    double elapsed =
+      std::chrono::duration<double>(now - this->last_report_).count();
+
+    if (received == this->last_received_)
+      {
+	stat.summary(diagnostic_msgs::DiagnosticStatus::ERROR,
+		     "No frames received");
+      }
+    else if ((timeouts != this->last_timeouts_) ||
+	     (dropped != this->last_dropped_))
+      {
+	stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+		     "Frames timed out or dropped");
+      }
+    else
+      {
+	stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Streaming");
+      }
+
+    stat.hardware_id = this->ip_;
+    stat.add("Connection",
+	     O3D3xxCamera::StateName(this->state_.load()));
+    stat.addf("Frame rate (Hz)", "%.2f", elapsed > 0.0 ?
+	      (received - this->last_received_) / elapsed : 0.0);
+    stat.add("Frames received", received);
+    stat.add("Frames published", this->published_frames_.load());
+    stat.add("Timeouts", timeouts);
+    stat.add("Dropped frames", dropped);
+    double first_frame = this->first_frame_secs_;
+    if (first_frame >= 0.0)
+      {
+	stat.addf("Time to first frame (s)", "%.2f", first_frame);
+      }
+    if (this->change_detector_)
+      {
+	stat.add("Static frames suppressed", this->static_frames_.load());
+      }
+    if (this->adaptive_rate_)
+      {
+	double rate = this->backoff_rate_.Rate();
+	if (rate > 0.0)
+	  {
+	    stat.addf("Backed off to (Hz)", "%.2f", rate);
+	  }
+	else
+	  {
+	    stat.add("Backed off to (Hz)", "not backed off");
+	  }
+      }
+    this->acquire_stats_.Report("acquire", stat);
+    if (this->temporal_filter_->Enabled())
+      {
+	this->filter_stats_.Report("temporal filter", stat);
+      }
+    this->convert_stats_.Report("convert", stat);
+    this->viz_stats_.Report("viz", stat);
+    this->publish_stats_.Report("publish", stat);
+
+    this->last_received_ = received;
+    this->last_timeouts_ = timeouts;
+    this->last_dropped_ = dropped;
+    this->last_report_ = now;
+  }
+
+  /**
+   * Copies the XYZ, depth, amplitude and confidence data of `buff' into the
+   * planes of `frame'.
+   */
+  static void FillFrame(const o3d3xx::ImageBuffer::Ptr& buff,
+			o3d3xx::Frame& frame)
+  {
+    cv::Mat depth = buff->DepthImage();
+    std::shared_ptr<pcl::PointCloud<o3d3xx::PointT> > cloud = buff->Cloud();
+
+    frame.height = depth.rows;
+    frame.width = depth.cols;
+
+    O3D3xxCamera::CopyPlane(depth, frame.depth);
+    O3D3xxCamera::CopyPlane(buff->AmplitudeImage(), frame.amplitude);
+    O3D3xxCamera::CopyPlane(buff->ConfidenceImage(), frame.confidence);
+
+    frame.xyz.resize(3 * cloud->points.size());
+    float* xyz = frame.xyz.data();
+    for (auto& pt : cloud->points)
+      {
+	*xyz++ = pt.x;
+	*xyz++ = pt.y;
+	*xyz++ = pt.z;
+      }
+  }
+
+  /**
+   * Copies the pixels of `img' into `plane', whose element type must match
+   * the pixel type of `img'.
+   */
+  template<typename T>
+  static void CopyPlane(const cv::Mat& img, std::vector<T>& plane)
+  {
+    std::size_t row_bytes = img.cols * img.elemSize();
+
+    plane.resize(img.total() * img.channels());
+    std::uint8_t* dst = reinterpret_cast<std::uint8_t*>(plane.data());
+
+    if (img.isContinuous())
+      {
+	std::memcpy(dst, img.data, img.rows * row_bytes);
+	return;
+      }
+
+    for (int r = 0; r < img.rows; ++r)
+      {
+	std::memcpy(dst + r * row_bytes, img.ptr(r), row_bytes);
+      }
+  }
+
+  /**
+   * RVL codes the CV_16UC1 image `img' into `msg', zeroing the pixels
+   * flagged invalid in `confidence' first if `rvl_mask_invalid' is set.
+   */
+  void Pack(const cv::Mat& img, const cv::Mat& confidence,
+	    o3d3xx::PackedImage& msg) const
+  {
+    // the frame's images are continuous, this is just in case
+    cv::Mat pixels = img.isContinuous() ? img : img.clone();
+    cv::Mat mask;
+    if (this->rvl_mask_invalid_ && (confidence.total() == img.total()))
+      {
+	mask = confidence.isContinuous() ? confidence : confidence.clone();
+      }
+
+    msg.height = pixels.rows;
+    msg.width = pixels.cols;
+    msg.encoding = o3d3xx_ros::rvl::ENCODING;
+    msg.mask_invalid = ! mask.empty();
+    o3d3xx_ros::rvl::Encode(pixels.ptr<std::uint16_t>(0),
+			    mask.empty() ? nullptr : mask.ptr<std::uint8_t>(0),
+			    pixels.total(), msg.data);
+  }
+
+  /**
+   * Wraps the point cloud owned by `buff' in a boost::shared_ptr suitable for
+   * publishing on a ROS topic. No copy is made: the returned pointer shares
+   * ownership of `buff' so the cloud lives until the last subscriber drops
+   * it.
+   */
+  static pcl::PointCloud<o3d3xx::PointT>::Ptr
+  WrapCloud(const o3d3xx::ImageBuffer::Ptr& buff)
+  {
+    std::shared_ptr<pcl::PointCloud<o3d3xx::PointT> > cloud = buff->Cloud();
+    return pcl::PointCloud<o3d3xx::PointT>::Ptr(
+	     cloud.get(),
+	     [buff, cloud](pcl::PointCloud<o3d3xx::PointT>*) { });
+  }
+
+  /**
+   * Implements the `Dump' service.
+   *
+   * The `Dump' service will dump the current camera configuration to a JSON
+   * string. This JSON string is suitable for editing and using to reconfigure
+   * the camera via the `Config' service.
+   *
+   * Reading the configuration puts the camera in edit mode, which interrupts
+   * streaming, so the result is cached and later calls are answered from the
+   * cache until `Config' or `Rm' change the configuration.
+   */
+  bool Dump(o3d3xx::Dump::Request &req,
+	    o3d3xx::Dump::Response &res)
+  {
+    std::lock_guard<std::mutex> lock(this->cam_mutex_);
+    res.status = 0;
+
+    if (this->config_cache_valid_)
+      {
+	res.config = this->config_cache_;
+	return true;
+      }
+
+    try
+      {
+	this->LoadConfig();
+	res.config = this->config_cache_;
+      }
+    catch (const o3d3xx::error_t& ex)
+      {
+	res.status = ex.code();
+      }
+    catch (const std::exception&)
+      {
+	res.status = -1;
+      }
+
+    this->ResetFrameGrabber();
+    return true;
+  }
+
+  /**
+   * Implements the `Config' service.
+   *
+   * The `Config' service will read the input JSON configuration data and
+   * mutate the camera's settings to match that of the configuration
+   * described by the JSON file. Syntactically, the JSON should look like the
+   * JSON that is produced by `Dump'. However, you need not specify every
+   * parameter. You can specify only the parameters you wish to change with the
+   * only caveat being that you need to specify the parameter as fully
+   * qualified from the top-level root of the JSON tree.
+   *
+   * Unless `config_diff' is off, the JSON is compared against the cached
+   * configuration first and only the parameters that differ are sent. If
+   * none do, the camera is left alone (and keeps streaming) altogether.
+   */
+  bool Config(o3d3xx::Config::Request &req,
+	      o3d3xx::Config::Response &res)
+  {
+    std::lock_guard<std::mutex> lock(this->cam_mutex_);
+    res.status = 0;
+    res.msg = "OK";
+
+    // whether the camera went through edit mode
+    bool touched = false;
+
+    try
+      {
+	if (! this->config_diff_)
+	  {
+	    touched = true;
+	    this->InvalidateConfig();
+	    this->cam_->FromJSON(req.json);
+	  }
+	else
+	  {
+	    o3d3xx_ros::config::ptree wanted =
+	      o3d3xx_ros::config::Parse(req.json);
+
+	    this->CheckConfig();
+	    if (! this->config_cache_valid_)
+	      {
+		touched = true;
+		this->LoadConfig();
+	      }
+
+	    o3d3xx_ros::config::ptree diff;
+	    if (o3d3xx_ros::config::Diff(wanted, &this->config_tree_, diff))
+	      {
+		touched = true;
+		this->InvalidateConfig();
+		this->cam_->FromJSON(o3d3xx_ros::config::Serialize(diff));
+
+		// new apps get their index from the camera, and a new imager
+		// type resets the imager's other parameters: those need a reload
+		if (o3d3xx_ros::config::Merge(diff, this->config_tree_))
+		  {
+		    this->config_cache_ =
+		      o3d3xx_ros::config::Serialize(this->config_tree_);
+		    this->config_cache_valid_ = true;
+		    this->SaveConfig();
+		  }
+		else
+		  {
+		    this->ReloadConfig();
+		  }
+	      }
+	    else
+	      {
+		res.msg = "OK (no changes)";
+	      }
+	  }
+      }
+    catch (const o3d3xx::error_t& ex)
+      {
+	res.status = ex.code();
+	res.msg = ex.what();
+      }
+    catch (const std::exception& std_ex)
+      {
+	res.status = -1;
+	res.msg = std_ex.what();
+      }
+
+    if (touched)
+      {
+	// the extrinsic calibration, or the resolution, may have changed
+	this->ResetUnitVectors();
+	this->ResetFrameGrabber();
+      }
+    return true;
+  }
+
+  /**
+   * Implements the `Rm' service.
+   *
+   * The `Rm' service is used to remove an application from the camera. This
+   * service restricts removing the current active application.
+   */
+  bool Rm(o3d3xx::Rm::Request &req,
+	  o3d3xx::Rm::Response &res)
+  {
+    std::lock_guard<std::mutex> lock(this->cam_mutex_);
+    this->InvalidateConfig();
+    res.status = 0;
+    res.msg = "OK";
+
+    try
+      {
+	if (req.index > 0)
+	  {
+	    this->cam_->RequestSession();
+	    this->cam_->SetOperatingMode(o3d3xx::Camera::operating_mode::EDIT);
+	    o3d3xx::DeviceConfig::Ptr dev = this->cam_->GetDeviceConfig();
+
+	    if (dev->ActiveApplication() != req.index)
+	      {
+		this->cam_->DeleteApplication(req.index);
+	      }
+	    else
+	      {
+		res.status = -1;
+		res.msg = std::string("Cannot delete active application!");
+	      }
+	  }
+      }
+    catch (const o3d3xx::error_t& ex)
+      {
+	res.status = ex.code();
+	res.msg = ex.what();
+      }
+    catch (const std::exception& std_ex)
+      {
+	res.status = -1;
+	res.msg = std_ex.what();
+      }
+
+    this->cam_->CancelSession(); // <-- OK to do this here
+    this->ResetFrameGrabber();
+    return true;
+  }
+
+  /**
+   * Implements the `SetActiveApp' service.
+   *
+   * The `SetActiveApp' service makes application `index' the active one.
+   * Unlike going through `Config', nothing but the device's active
+   * application is read or written, and nothing at all if `index' is
+   * already active. `latency' is the time, in seconds, from the request
+   * until the first frame of the new application was received.
+   */
+  bool SetActiveApp(o3d3xx::SetActiveApp::Request &req,
+		    o3d3xx::SetActiveApp::Response &res)
+  {
+    std::lock_guard<std::mutex> lock(this->cam_mutex_);
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    res.status = 0;
+    res.msg = "OK";
+    res.latency = 0.0;
+
+    try
+      {
+	if (std::stoi(this->cam_->GetParameter("ActiveApplication")) ==
+	    req.index)
+	  {
+	    res.msg = "OK (already active)";
+	    return true;
+	  }
+
+	this->cam_->RequestSession();
+	this->cam_->SetOperatingMode(o3d3xx::Camera::operating_mode::EDIT);
+	o3d3xx::DeviceConfig::Ptr dev = this->cam_->GetDeviceConfig();
+	dev->SetActiveApplication(req.index);
+	this->cam_->SetDeviceConfig(dev.get());
+	this->cam_->SaveDevice();
+      }
+    catch (const o3d3xx::error_t& ex)
+      {
+	res.status = ex.code();
+	res.msg = ex.what();
+      }
+    catch (const std::exception& std_ex)
+      {
+	res.status = -1;
+	res.msg = std_ex.what();
+      }
+
+    this->cam_->CancelSession();
+
+    if ((res.status == 0) && this->config_cache_valid_)
+      {
+	this->config_tree_.put("o3d3xx.Device.ActiveApplication",
+			       std::to_string(req.index));
+	this->config_cache_ =
+	  o3d3xx_ros::config::Serialize(this->config_tree_);
+	this->SaveConfig();
+      }
+
+    std::uint64_t generation = this->ResetFrameGrabber();
+    if (res.status != 0)
+      {
+	return true;
+      }
+
+    // wait for the acquisition thread to get a frame from the new grabber
+    std::chrono::steady_clock::time_point deadline =
+      std::chrono::steady_clock::now() +
+      std::chrono::milliseconds(4 * this->timeout_millis_);
+
+    while ((this->frame_generation_ < generation) &&
+	   (std::chrono::steady_clock::now() < deadline))
+      {
+	std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+
+    res.latency = std::chrono::duration<double>(
+      std::chrono::steady_clock::now() - start).count();
+
+    if (this->frame_generation_ < generation)
+      {
+	res.msg = "OK (no frame received yet)";
+      }
+
+    return true;
+  }
+
+private:
+  /**
+   * Whether `pub' has subscribers and `rate' would let `stamp' through
+   */
+  template<typename P>
+  static bool Wants(const P& pub, const o3d3xx_ros::RateLimiter& rate,
+		    const ros::Time& stamp)
+  {
+    return (pub.getNumSubscribers() > 0) && rate.Ready(stamp);
+  }
+
+  /**
+   * With `adaptive_rate', called when a frame was dropped: lowers the rate
+   * frames are let into the queue at to 3/4 of what it was (or of what the
+   * camera delivers), but not below `min_rate'.
+   */
+  void BackOff()
+  {
+    std::lock_guard<std::mutex> lock(this->backoff_mutex_);
+    double rate = this->backoff_rate_.Rate();
+    if (rate <= 0.0)
+      {
+	rate = this->input_rate_;
+      }
+
+    rate = std::max(this->min_rate_, 0.75 * rate);
+    if (rate != this->backoff_rate_.Rate())
+      {
+	ROS_WARN("Backing off to %.2f Hz (%s)", rate, this->name_.c_str());
+      }
+
+    this->backoff_rate_.SetRate(rate);
+    this->backoff_changed_ = std::chrono::steady_clock::now();
+  }
+
+  /**
+   * Raises the backed off rate by a quarter for every 5 s without drops,
+   * until it reaches the rate of the camera and is lifted.
+   */
+  void Recover()
+  {
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+
+    std::lock_guard<std::mutex> lock(this->backoff_mutex_);
+    double rate = this->backoff_rate_.Rate();
+    if ((rate <= 0.0) ||
+	(now - this->backoff_changed_ < std::chrono::seconds(5)))
+      {
+	return;
+      }
+
+    rate *= 1.25;
+    if (rate >= this->input_rate_)
+      {
+	rate = 0.0;
+	ROS_INFO("No longer backing off (%s)", this->name_.c_str());
+      }
+
+    this->backoff_rate_.SetRate(rate);
+    this->backoff_changed_ = now;
+  }
+
+  /**
+   * Learns the rays of the pixels from the cloud and depth of `buff', and
+   * publishes them on `unit_vectors' after the first frame and once
+   * learning is done. Frames that come in while another worker is at it are
+   * skipped.
+   */
+  void LearnUnitVectors(const o3d3xx::ImageBuffer::Ptr& buff,
+			const ros::Time& stamp,
+			std::chrono::steady_clock::duration& published)
+  {
+    std::unique_lock<std::mutex> lock(this->unit_vectors_mutex_,
+				      std::try_to_lock);
+    if (! lock.owns_lock())
+      {
+	return;
+      }
+
+    // nothing is learned from frames that do not give the origin away
+    bool learned =
+      this->unit_vectors_.Learn(*buff->Cloud(), buff->DepthImage(),
+				buff->ConfidenceImage());
+    bool complete = this->unit_vectors_.Complete();
+    if ((! complete) && (this->unit_vectors_published_ || (! learned)))
+      {
+	return;
+      }
+
+    o3d3xx::UnitVectorsPtr msg(new o3d3xx::UnitVectors());
+    this->unit_vectors_.Fill(*msg);
+    msg->header.frame_id = this->frame_id_;
+    msg->header.stamp = stamp;
+    O3D3xxCamera::Send(this->unit_vectors_pub_, msg, published);
+
+    this->unit_vectors_published_ = true;
+    this->unit_vectors_complete_ = complete;
+
+    if (complete && this->cache_)
+      {
+	try
+	  {
+	    this->cache_->SaveUnitVectors(*msg);
+	  }
+	catch (const std::exception& ex)
+	  {
+	    ROS_WARN("Could not cache the unit vectors: %s (%s)", ex.what(),
+		     this->name_.c_str());
+	  }
+      }
+  }
+
+  /**
+   * Has the rays learned anew from the next frames
+   */
+  void ResetUnitVectors()
+  {
+    std::lock_guard<std::mutex> lock(this->unit_vectors_mutex_);
+    this->unit_vectors_.Reset();
+    this->unit_vectors_published_ = false;
+    this->unit_vectors_complete_ = false;
+  }
+
+  /**
+   * Publishes `msg' on `pub', adding the time it took to `spent'
+   */
+  template<typename P, typename M>
+  static void Send(P& pub, const M& msg,
+		   std::chrono::steady_clock::duration& spent)
+  {
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    pub.publish(msg);
+    spent += std::chrono::steady_clock::now() - start;
+  }
+
+  static const char* StateName(int state)
+  {
+    switch (state)
+      {
+      case o3d3xx::ConnectionState::CONNECTING:
+	return "connecting";
+      case o3d3xx::ConnectionState::STREAMING:
+	return "streaming";
+      case o3d3xx::ConnectionState::STALLED:
+	return "stalled";
+      case o3d3xx::ConnectionState::RECONNECTING:
+	return "reconnecting";
+      }
+    return "unknown";
+  }
+
+  /**
+   * Publishes the connection state on `connection_state'
+   */
+  void PublishState()
+  {
+    o3d3xx::ConnectionState msg;
+    msg.header.stamp = ros::Time::now();
+    msg.header.frame_id = this->frame_id_;
+    msg.state = this->state_;
+    msg.attempts = this->reconnect_attempts_;
+    msg.downtime =
+      msg.state == o3d3xx::ConnectionState::STREAMING ? 0.0 :
+      std::chrono::duration<double>(
+	std::chrono::steady_clock::now() - this->last_frame_at_).count();
+    this->state_pub_.publish(msg);
+  }
+
+  /**
+   * Runs the connection state machine on a timeout of `WaitForFrame'
+   */
+  void TimedOut()
+  {
+    this->consecutive_timeouts_++;
+
+    if (this->state_ == o3d3xx::ConnectionState::RECONNECTING)
+      {
+	ROS_WARN_THROTTLE(10.0, "Camera still not answering after %u "
+			  "reconnect attempts (%s)",
+			  this->reconnect_attempts_, this->name_.c_str());
+	this->backoff_millis_ =
+	  std::min(2 * this->backoff_millis_,
+		   std::max(this->timeout_millis_, static_cast<int>(
+			      this->reconnect_max_backoff_ * 1000)));
+	this->Reconnect();
+	return;
+      }
+
+    ROS_WARN("Timeout waiting for camera! (%s)", this->name_.c_str());
+
+    if ((this->reconnect_timeouts_ > 0) &&
+	(this->consecutive_timeouts_ >= this->reconnect_timeouts_))
+      {
+	ROS_WARN("Lost the camera, reconnecting (%s)", this->name_.c_str());
+	this->state_ = o3d3xx::ConnectionState::RECONNECTING;
+	this->backoff_millis_ = this->timeout_millis_;
+	this->Reconnect();
+      }
+    else if (this->state_ == o3d3xx::ConnectionState::STREAMING)
+      {
+	this->state_ = o3d3xx::ConnectionState::STALLED;
+	this->PublishState();
+      }
+  }
+
+  /**
+   * Runs the connection state machine on a frame from `WaitForFrame'
+   */
+  void FrameReceived()
+  {
+    if (this->state_ != o3d3xx::ConnectionState::STREAMING)
+      {
+	if (this->reconnect_attempts_ > 0)
+	  {
+	    ROS_INFO("Camera is back after %.1f s and %u reconnect "
+		     "attempts (%s)",
+		     std::chrono::duration<double>(
+		       std::chrono::steady_clock::now() -
+		       this->last_frame_at_).count(),
+		     this->reconnect_attempts_, this->name_.c_str());
+	  }
+
+	this->state_ = o3d3xx::ConnectionState::STREAMING;
+	this->reconnect_attempts_ = 0;
+	this->PublishState();
+      }
+
+    this->consecutive_timeouts_ = 0;
+    this->last_frame_at_ = std::chrono::steady_clock::now();
+
+    if (this->first_frame_secs_ < 0.0)
+      {
+	double secs = std::chrono::duration<double>(
+	  this->last_frame_at_ - this->started_at_).count();
+	this->first_frame_secs_ = secs;
+	ROS_INFO("First frame %.2f s after startup (%s)", secs,
+		 this->name_.c_str());
+      }
+  }
+
+  /**
+   * Recreates the camera, unless a service is using it (and about to
+   * reset the frame grabber anyway), and the frame grabber.
+   */
+  void Reconnect()
+  {
+    this->reconnect_attempts_++;
+    this->PublishState();
+
+    try
+      {
+	std::unique_lock<std::mutex> lock(this->cam_mutex_, std::try_to_lock);
+	if (lock.owns_lock())
+	  {
+	    this->cam_ = std::make_shared<o3d3xx::Camera>(
+	      this->ip_, this->xmlrpc_port_, this->password_);
+	    this->config_cache_valid_ = false;
+	    this->ResetUnitVectors();
+	  }
+
+	this->ResetFrameGrabber();
+      }
+    catch (const std::exception& ex)
+      {
+	ROS_WARN_THROTTLE(10.0, "Reconnecting failed: %s (%s)", ex.what(),
+			  this->name_.c_str());
+      }
+  }
+
+  /**
+   * Reads the configuration from the camera into the cache. The caller
+   * holds `cam_mutex_' and resets the frame grabber afterwards.
+   */
+  void LoadConfig()
+  {
+    this->config_cache_valid_ = false;
+    this->config_cache_ = this->cam_->ToJSON();
+    this->config_tree_ = o3d3xx_ros::config::Parse(this->config_cache_);
+    this->config_cache_valid_ = true;
+    this->config_cache_checked_ = true;
+    this->SaveConfig();
+  }
+
+  /**
+   * Checks a configuration taken from `cache_dir' against what the camera
+   * tells without leaving run mode (see `o3d3xx_ros::config::Matches'),
+   * once, and drops it if the camera differs. The caller holds
+   * `cam_mutex_'.
+   */
+  void CheckConfig()
+  {
+    if ((! this->config_cache_valid_) || this->config_cache_checked_)
+      {
+	return;
+      }
+
+    bool matches = false;
+    try
+      {
+	std::vector<std::pair<std::string, std::string> > apps;
+	for (auto& app : this->cam_->GetApplicationList())
+	  {
+	    apps.push_back(std::make_pair(std::to_string(app.index),
+					  std::to_string(app.id)));
+	  }
+
+	matches = o3d3xx_ros::config::Matches(this->config_tree_,
+					      this->cam_->GetHWInfo(),
+					      this->cam_->GetAllParameters(),
+					      apps);
+      }
+    catch (const std::exception& ex)
+      {
+	ROS_WARN("Could not check the cached configuration: %s (%s)",
+		 ex.what(), this->name_.c_str());
+      }
+
+    if (matches)
+      {
+	this->config_cache_checked_ = true;
+	return;
+      }
+
+    ROS_INFO("The cached configuration is not the camera's, reading it "
+	     "anew (%s)", this->name_.c_str());
+    this->config_cache_valid_ = false;
+  }
+
+  /**
+   * Reads the configuration back from the camera after it was changed in
+   * a way the cache cannot follow. A failure only leaves the cache invalid,
+   * to be read on next use; the change itself went through. The caller
+   * holds `cam_mutex_'.
+   */
+  void ReloadConfig()
+  {
+    try
+      {
+	this->LoadConfig();
+      }
+    catch (const std::exception& ex)
+      {
+	this->config_cache_valid_ = false;
+	ROS_WARN("Could not reload the configuration: %s (%s)", ex.what(),
+		 this->name_.c_str());
+      }
+  }
+
+  /**
+   * Drops the cached configuration, on disk too, as it is about to change.
+   * The caller holds `cam_mutex_'.
+   */
+  void InvalidateConfig()
+  {
+    this->config_cache_valid_ = false;
+    if (this->cache_)
+      {
+	this->cache_->ForgetConfig();
+      }
+  }
+
+  /**
+   * Saves the cached configuration to `cache_dir', if set. The caller holds
+   * `cam_mutex_'.
+   */
+  void SaveConfig()
+  {
+    if (! this->cache_)
+      {
+	return;
+      }
+
+    try
+      {
+	this->cache_->SaveConfig(this->config_cache_);
+      }
+    catch (const std::exception& ex)
+      {
+	ROS_WARN("Could not cache the configuration: %s (%s)", ex.what(),
+		 this->name_.c_str());
+      }
+  }
+
+  /**
+   * Opens the cache in `dir' and takes the configuration and unit vectors
+   * saved by an earlier run from it: the former answers `Dump' right away
+   * and, once `CheckConfig' found it to match the camera, is what `Config'
+   * compares against; the latter is published on `unit_vectors' right
+   * away. Either is replaced as soon as it is read from the camera again,
+   * e.g., after the camera was reconfigured or reconnected.
+   */
+  void LoadCache(const std::string& dir)
+  {
+    try
+      {
+	this->cache_.reset(
+	  new o3d3xx_ros::MetadataCache(dir, this->ip_, this->xmlrpc_port_));
+      }
+    catch (const std::exception& ex)
+      {
+	ROS_WARN("Not caching metadata: %s (%s)", ex.what(),
+		 this->name_.c_str());
+	return;
+      }
+
+    std::string json;
+    if (this->cache_->LoadConfig(json))
+      {
+	try
+	  {
+	    this->config_tree_ = o3d3xx_ros::config::Parse(json);
+	    this->config_cache_ = json;
+	    this->config_cache_valid_ = true;
+	    this->config_cache_checked_ = false;
+	  }
+	catch (const std::exception& ex)
+	  {
+	    ROS_WARN("Ignoring the cached configuration: %s (%s)", ex.what(),
+		     this->name_.c_str());
+	  }
+      }
+
+    o3d3xx::UnitVectorsPtr msg(new o3d3xx::UnitVectors());
+    if (this->cache_->LoadUnitVectors(*msg) &&
+	this->unit_vectors_.Restore(*msg))
+      {
+	msg->header.frame_id = this->frame_id_;
+	msg->header.stamp = ros::Time::now();
+	this->unit_vectors_pub_.publish(msg);
+	this->unit_vectors_published_ = true;
+	this->unit_vectors_complete_ = true;
+      }
+
+    ROS_INFO("Metadata cache: %s, configuration %s, unit vectors %s (%s)",
+	     this->cache_->Dir().c_str(),
+	     this->config_cache_valid_ ? "loaded" : "not cached",
+	     this->unit_vectors_complete_ ? "loaded" : "not cached",
+	     this->name_.c_str());
+  }
+
+  /**
+   * Connects a new frame grabber, e.g., after the camera went through edit
+   * mode, and hands it to the acquisition thread. The old one is released
+   * outside of the lock.
+   *
+   * Returns the generation of the new grabber; `frame_generation_' reaches
+   * it once a frame has been received through it.
+   */
+  std::uint64_t ResetFrameGrabber()
+  {
+    o3d3xx::FrameGrabber::Ptr fg =
+      std::make_shared<o3d3xx::FrameGrabber>(this->cam_);
+
+    std::lock_guard<std::mutex> lock(this->fg_mutex_);
+    this->fg_.swap(fg);
+    return ++this->fg_generation_;
+  }
+
+  int timeout_millis_;
+  bool publish_viz_images_;
+  bool camera_stamps_;
+  bool camera_stamps_warned_;
+  double stamp_offset_;
+  o3d3xx_ros::ClockOffsetEstimator clock_offset_;
+  std::string name_;
+  std::string ip_;
+  int xmlrpc_port_;
+  std::string password_;
+  o3d3xx::Camera::Ptr cam_;
+  o3d3xx::FrameGrabber::Ptr fg_;
+  std::mutex fg_mutex_;
+  std::uint64_t fg_generation_;
+  std::atomic<std::uint64_t> frame_generation_;
+
+  // connection state machine, run by the acquisition thread
+  int reconnect_timeouts_;
+  double reconnect_max_backoff_;
+  std::atomic<int> state_;
+  int consecutive_timeouts_;
+  std::uint32_t reconnect_attempts_;
+  int backoff_millis_;
+  std::chrono::steady_clock::time_point last_frame_at_;
+  ros::Publisher state_pub_;
+
+  // serializes the services' XMLRPC sessions; never taken on the frame path
+  std::mutex cam_mutex_;
+  std::string config_cache_;
+  o3d3xx_ros::config::ptree config_tree_;
+  bool config_cache_valid_;
+  // false while the cache comes from disk and was not checked against the
+  // camera, which only `Dump' trusts it without
+  bool config_cache_checked_;
+  bool config_diff_;
+  bool rvl_mask_invalid_;
+
+  std::unique_ptr<o3d3xx_ros::BoundedQueue<o3d3xx::ImageBuffer::Ptr> >
+    free_buffers_;
+
+  // per-topic `max_rate' and, with `adaptive_rate', the rate frames are
+  // let into the queue at while publishing is not keeping up
+  o3d3xx_ros::RateLimiter cloud_rate_;
+  o3d3xx_ros::RateLimiter depth_rate_;
+  o3d3xx_ros::RateLimiter depth_rvl_rate_;
+  o3d3xx_ros::RateLimiter depth_viz_rate_;
+  o3d3xx_ros::RateLimiter amplitude_rate_;
+  o3d3xx_ros::RateLimiter amplitude_rvl_rate_;
+  o3d3xx_ros::RateLimiter conf_rate_;
+  o3d3xx_ros::RateLimiter good_bad_rate_;
+  o3d3xx_ros::RateLimiter hist_rate_;
+  o3d3xx_ros::RateLimiter frame_rate_;
+  bool adaptive_rate_;
+  double min_rate_;
+  o3d3xx_ros::RateLimiter backoff_rate_;
+  std::mutex backoff_mutex_;
+  std::chrono::steady_clock::time_point backoff_changed_;
+  std::atomic<double> input_rate_;
+  std::chrono::steady_clock::time_point last_received_at_;
+
+  // with `change_detection', run by the acquisition thread
+  std::unique_ptr<o3d3xx_ros::ChangeDetector> change_detector_;
+
+  // counters and stage timings for the diagnostics
+  std::atomic<std::uint64_t> received_frames_;
+  std::atomic<std::uint64_t> timeouts_;
+  std::atomic<std::uint64_t> dropped_frames_;
+  std::atomic<std::uint64_t> published_frames_;
+  std::atomic<std::uint64_t> static_frames_;
+  o3d3xx_ros::StageStats acquire_stats_;
+  o3d3xx_ros::StageStats filter_stats_;
+  o3d3xx_ros::StageStats convert_stats_;
+  o3d3xx_ros::StageStats viz_stats_;
+  o3d3xx_ros::StageStats publish_stats_;
+  std::uint64_t last_received_;
+  std::uint64_t last_timeouts_;
+  std::uint64_t last_dropped_;
+  std::chrono::steady_clock::time_point last_report_;
+  std::chrono::steady_clock::time_point started_at_;
+  std::atomic<double> first_frame_secs_;
+
+  std::string frame_id_;
+  std::unique_ptr<o3d3xx_ros::CloudFilter> filter_;
+
+  // run by the acquisition thread, see `Wanted'
+  std::unique_ptr<o3d3xx_ros::TemporalFilter> temporal_filter_;
+  double temporal_max_gap_;
+  ros::Time temporal_stamp_;
+  o3d3xx_ros::cloud_encoding cloud_encoding_;
+  ros::Publisher cloud_pub_;
+  image_transport::Publisher depth_pub_;
+  image_transport::Publisher depth_viz_pub_;
+  image_transport::Publisher amplitude_pub_;
+  image_transport::Publisher conf_pub_;
+  image_transport::Publisher good_bad_pub_;
+  image_transport::Publisher hist_pub_;
+  ros::Publisher frame_pub_;
+  ros::Publisher depth_rvl_pub_;
+
+  // rays of the pixels for `unit_vectors', learned by the workers
+  ros::Publisher unit_vectors_pub_;
+  o3d3xx_ros::UnitVectorLearner unit_vectors_;
+  std::mutex unit_vectors_mutex_;
+  std::atomic<bool> unit_vectors_complete_;
+  bool unit_vectors_published_;
+  ros::Publisher amplitude_rvl_pub_;
+
+  ros::ServiceServer dump_srv_;
+  ros::ServiceServer config_srv_;
+  ros::ServiceServer rm_srv_;
+  ros::ServiceServer set_active_app_srv_;
+  ros::NodeHandle srv_nh_;
+  std::string srv_prefix_;
+  std::vector<int> service_cpus_;
+  ros::CallbackQueue service_queue_;
+  std::unique_ptr<ros::AsyncSpinner> service_spinner_;
+
+  // with `cache_dir', whatever outlives a run; written under `cam_mutex_'
+  // and `unit_vectors_mutex_'
+  std::unique_ptr<o3d3xx_ros::MetadataCache> cache_;
+
+}; // end: class O3D3xxCamera
+
+#endif // __O3D3XX_ROS_O3D3XX_CAMERA_H__
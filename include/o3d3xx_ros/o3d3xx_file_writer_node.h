@@ -0,0 +1,910 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_O3D3XX_FILE_WRITER_NODE_H__
+#define __O3D3XX_ROS_O3D3XX_FILE_WRITER_NODE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <cv_bridge/cv_bridge.h>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <o3d3xx/image.h>
+#include <o3d3xx/Trigger.h>
+#include <o3d3xx_ros/black_box.h>
+#include <o3d3xx_ros/bounded_queue.h>
+#include <o3d3xx_ros/point_cloud2.h>
+#include <o3d3xx_ros/segment.h>
+#include <o3d3xx_ros/stage_stats.h>
+#include <o3d3xx_ros/thread_config.h>
+#include <opencv2/opencv.hpp>
+#include <pcl/io/pcd_io.h>
+#include <pcl_ros/point_cloud.h>
+#include <ros/ros.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/image_encodings.h>
+#include <std_msgs/Empty.h>
+
+/**
+ * Subscribes to the camera topics and writes each message to its own file,
+ * or, in `container' mode, appends all of them to a series of segment files
+ * (see `o3d3xx_ros::SegmentWriter').
+ *
+ * The subscriber callbacks only queue the incoming messages; encoding and
+ * writing happen on a pool of writer threads so a slow disk never backs up
+ * the subscriptions. When the writers fall behind and the queue fills up,
+ * new messages are dropped (and counted) rather than blocking intake.
+ *
+ * With `pre_trigger' set, this is a black box instead: the last
+ * `pre_trigger' seconds of messages are only held in memory (see
+ * `o3d3xx_ros::BlackBox') and nothing is written until the `Trigger' service
+ * is called or a message comes in on `trigger'. Then the messages held are
+ * queued for writing, followed by everything received during the next
+ * `post_trigger' seconds; a trigger meanwhile extends that window.
+ *
+ * The queue, the written and dropped counts and the time spent per stage --
+ * waiting in the queue, encoding and writing to disk -- are reported on
+ * `/diagnostics' once a second.
+ *
+ * Like `O3D3xxNode', names are resolved relative to the (private) node
+ * handle passed to the constructor, so this runs either standalone via
+ * `o3d3xx_file_writer_node' or as the `O3D3xxFileWriterNodelet'.
+ */
+class O3D3xxFileWriterNode
+{
+public:
+  /**
+   * How point clouds are written out
+   */
+  enum class cloud_format : int
+  {
+    ASCII = 0,
+    BINARY = 1,
+    BINARY_COMPRESSED = 2,
+    RAW = 3
+  };
+
+  O3D3xxFileWriterNode(ros::NodeHandle nh)
+    : outdir_("/tmp"),
+      dump_yaml_(false),
+      container_(false),
+      cloud_format_(cloud_format::ASCII),
+      cloud_encoding_(o3d3xx_ros::cloud_encoding::PCL),
+      running_(true),
+      cloud_idx_(0),
+      depth_idx_(0),
+      amplitude_idx_(0),
+      confidence_idx_(0),
+      written_(0),
+      dropped_(0),
+      max_depth_(0),
+      last_written_(0),
+      last_dropped_(0),
+      last_report_(std::chrono::steady_clock::now()),
+      triggers_(0)
+  {
+    int write_queue_size;
+    int num_writers;
+    double stats_period;
+    int segment_size;
+    double segment_duration;
+    double pre_trigger;
+    double post_trigger;
+    int black_box_size;
+    bool write_cloud;
+
+    nh.param("outdir", this->outdir_, std::string("/tmp"));
+    nh.param("dump_yaml", this->dump_yaml_, false);
+    nh.param("write_cloud", write_cloud, true);
+    nh.param("container", this->container_, false);
+    nh.param("segment_size", segment_size, 1024);
+    nh.param("segment_duration", segment_duration, 0.0);
+    nh.param("write_queue_size", write_queue_size, 100);
+    nh.param("num_writers", num_writers, 2);
+    nh.param("writer_cpus", this->writer_cpus_, std::vector<int>());
+    nh.param("stats_period", stats_period, 10.0);
+    nh.param("pre_trigger", pre_trigger, 0.0);
+    nh.param("post_trigger", post_trigger, 5.0);
+    nh.param("black_box_size", black_box_size, 1000);
+
+    if (write_queue_size < 1)
+      {
+	throw std::runtime_error("write_queue_size must be at least 1");
+      }
+
+    if (num_writers < 1)
+      {
+	throw std::runtime_error("num_writers must be at least 1");
+      }
+
+    o3d3xx_ros::CheckCpus(this->writer_cpus_, "writer_cpus");
+
+    if (post_trigger < 0.0)
+      {
+	throw std::runtime_error("post_trigger must not be negative");
+      }
+
+    std::string encoding;
+    nh.param("cloud_encoding", encoding, std::string("pcl"));
+    this->cloud_encoding_ = o3d3xx_ros::ParseCloudEncoding(encoding);
+
+    std::string format;
+    nh.param("cloud_format", format, std::string("ascii"));
+    if (format == "ascii")
+      {
+	this->cloud_format_ = cloud_format::ASCII;
+      }
+    else if (format == "binary")
+      {
+	this->cloud_format_ = cloud_format::BINARY;
+      }
+    else if (format == "binary_compressed")
+      {
+	this->cloud_format_ = cloud_format::BINARY_COMPRESSED;
+      }
+    else if (format == "raw")
+      {
+	this->cloud_format_ = cloud_format::RAW;
+      }
+    else
+      {
+	throw std::runtime_error("Invalid cloud_format: " + format);
+      }
+
+    // make sure the output directories exist
+    std::vector<std::string> dirs =
+      {"cloud", "depth", "amplitude", "confidence"};
+    if (this->container_)
+      {
+	dirs = {"segments"};
+      }
+
+    for (auto& dir : dirs)
+      {
+	std::string target_dir = this->outdir_ + "/" + dir;
+
+	if(! boost::filesystem::create_directories(target_dir))
+	  {
+	    if (boost::filesystem::is_directory(target_dir))
+	      {
+		throw std::runtime_error("Directory already exists: " +
+					 target_dir);
+	      }
+	    else
+	      {
+		throw std::runtime_error("Could not create directory: " +
+					 target_dir);
+	      }
+	  }
+      }
+
+    if (this->container_)
+      {
+	this->segments_.reset(
+	  new o3d3xx_ros::SegmentWriter(
+	    this->outdir_ + "/segments",
+	    static_cast<std::uint64_t>(std::max(segment_size, 0)) << 20,
+	    segment_duration));
+      }
+
+    //----------------------
+    // Black box
+    //----------------------
+    std::size_t queue_size = write_queue_size;
+    if (pre_trigger > 0.0)
+      {
+	this->black_box_.reset(
+	  new o3d3xx_ros::BlackBox<WriteJob>(
+	    std::max(black_box_size, 0),
+	    std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+	      std::chrono::duration<double>(pre_trigger))));
+	this->post_trigger_ =
+	  std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+	    std::chrono::duration<double>(post_trigger));
+
+	// room for a whole black box on top of the live messages, so
+	// flushing it on a trigger never drops anything
+	queue_size += this->black_box_->Capacity();
+      }
+
+    //----------------------
+    // Writer threads
+    //----------------------
+    this->jobs_.reset(
+      new o3d3xx_ros::BoundedQueue<WriteJob>(queue_size));
+
+    for (int i = 0; i < num_writers; ++i)
+      {
+	this->writers_.emplace_back(&O3D3xxFileWriterNode::WriteLoop, this);
+      }
+
+    if (stats_period > 0.0)
+      {
+	this->stats_timer_ =
+	  nh.createTimer(ros::Duration(stats_period),
+			 &O3D3xxFileWriterNode::StatsCb, this);
+      }
+
+    this->updater_.reset(
+      new diagnostic_updater::Updater(ros::NodeHandle(), nh));
+    this->updater_->setHardwareID("none");
+    this->updater_->add(nh.getNamespace(), this,
+			&O3D3xxFileWriterNode::Diagnose);
+    this->diag_timer_ =
+      nh.createTimer(ros::Duration(1.0),
+		     &O3D3xxFileWriterNode::DiagnosticsCb, this);
+
+    //----------------------
+    // Subscribed topics
+    //----------------------
+    // pcl_ros reads float32 fields into the cloud by name, but not the
+    // int16 ones, which are decoded here. Without `write_cloud', not
+    // subscribing spares the camera node converting the cloud as well.
+    if (write_cloud &&
+	(this->cloud_encoding_ == o3d3xx_ros::cloud_encoding::INT16))
+      {
+	this->cloud_sub_ =
+	  nh.subscribe<sensor_msgs::PointCloud2>
+	  ("/cloud", 10,
+	   std::bind(&O3D3xxFileWriterNode::PackedCloudCb, this,
+		     std::placeholders::_1));
+      }
+    else if (write_cloud)
+      {
+	this->cloud_sub_ =
+	  nh.subscribe<pcl::PointCloud<o3d3xx::PointT> >
+	  ("/cloud", 10,
+	   std::bind(&O3D3xxFileWriterNode::CloudCb, this,
+		     std::placeholders::_1));
+      }
+
+    this->depth_sub_ =
+      nh.subscribe<sensor_msgs::Image>
+      ("/depth", 10,
+       std::bind(&O3D3xxFileWriterNode::ImageCb, this,
+		 std::placeholders::_1, "depth"));
+
+    this->amplitude_sub_ =
+      nh.subscribe<sensor_msgs::Image>
+      ("/amplitude", 10,
+       std::bind(&O3D3xxFileWriterNode::ImageCb, this,
+		 std::placeholders::_1, "amplitude"));
+
+    this->confidence_sub_ =
+      nh.subscribe<sensor_msgs::Image>
+      ("/confidence", 10,
+       std::bind(&O3D3xxFileWriterNode::ImageCb, this,
+		 std::placeholders::_1, "confidence"));
+
+    if (this->black_box_)
+      {
+	this->trigger_sub_ =
+	  nh.subscribe<std_msgs::Empty>
+	  ("trigger", 10,
+	   std::bind(&O3D3xxFileWriterNode::TriggerCb, this,
+		     std::placeholders::_1));
+
+	this->trigger_srv_ =
+	  nh.advertiseService<o3d3xx::Trigger::Request,
+			      o3d3xx::Trigger::Response>
+	  ("Trigger", std::bind(&O3D3xxFileWriterNode::Trigger, this,
+				std::placeholders::_1,
+				std::placeholders::_2));
+
+	ROS_INFO("File writer armed: holding the last %.1f s (at most %zu "
+		 "messages), recording %.1f s after a trigger",
+		 pre_trigger, this->black_box_->Capacity(), post_trigger);
+      }
+  }
+
+  /**
+   * Stops intake and waits for the writer threads to flush whatever is still
+   * queued. Messages still held in the black box are not written.
+   */
+  ~O3D3xxFileWriterNode()
+  {
+    this->trigger_srv_.shutdown();
+    this->trigger_sub_.shutdown();
+    this->cloud_sub_.shutdown();
+    this->depth_sub_.shutdown();
+    this->amplitude_sub_.shutdown();
+    this->confidence_sub_.shutdown();
+    this->stats_timer_.stop();
+    this->diag_timer_.stop();
+
+    this->running_ = false;
+    for (auto& t : this->writers_)
+      {
+	t.join();
+      }
+
+    ROS_INFO("File writer done: %lu messages written, %lu dropped",
+	     (unsigned long) this->written_.load(),
+	     (unsigned long) this->dropped_.load());
+  }
+
+  /**
+   * Callback on the "/cloud" topic
+   */
+  void CloudCb(const pcl::PointCloud<o3d3xx::PointT>::ConstPtr& cloud)
+  {
+    WriteJob job;
+    job.stream = "cloud";
+    job.cloud = cloud;
+    this->Accept(job);
+  }
+
+  /**
+   * Callback on the "/cloud" topic with `cloud_encoding' int16
+   */
+  void PackedCloudCb(const sensor_msgs::PointCloud2::ConstPtr& msg)
+  {
+    pcl::PointCloud<o3d3xx::PointT>::Ptr
+      cloud(new pcl::PointCloud<o3d3xx::PointT>());
+    if (! o3d3xx_ros::UnpackCloud(*msg, *cloud))
+      {
+	ROS_WARN_THROTTLE(5.0, "Dropping a cloud that is not packed like "
+			  "the camera's int16 cloud_encoding");
+	return;
+      }
+
+    // PCL clouds are stamped in microseconds
+    cloud->header.frame_id = msg->header.frame_id;
+    cloud->header.stamp = msg->header.stamp.toNSec() / 1000;
+    cloud->header.seq = msg->header.seq;
+    this->CloudCb(cloud);
+  }
+
+  /**
+   * Callback on the "/depth", "/amplitude", and "/confidence" topics
+   */
+  void ImageCb(const sensor_msgs::Image::ConstPtr& im,
+	       const std::string& im_type)
+  {
+    WriteJob job;
+    job.stream = im_type;
+    job.im = im;
+    this->Accept(job);
+  }
+
+  /**
+   * Callback on the "trigger" topic
+   */
+  void TriggerCb(const std_msgs::Empty::ConstPtr&)
+  {
+    this->Fire();
+  }
+
+  /**
+   * Implements the `Trigger' service
+   */
+  bool Trigger(o3d3xx::Trigger::Request& req,
+	       o3d3xx::Trigger::Response& res)
+  {
+    std::size_t held = this->Fire();
+
+    res.status = 0;
+    res.msg = "OK (" + std::to_string(held) + " messages flushed)";
+    return true;
+  }
+
+  /**
+   * Logs the state of the write queue, every `stats_period' seconds
+   */
+  void StatsCb(const ros::TimerEvent&)
+  {
+    ROS_INFO("File writer: %zu/%zu queued (max %zu), %lu written, "
+	     "%lu dropped",
+	     this->jobs_->Size(), this->jobs_->Capacity(),
+	     this->max_depth_.exchange(0),
+	     (unsigned long) this->written_.load(),
+	     (unsigned long) this->dropped_.load());
+  }
+
+  void DiagnosticsCb(const ros::TimerEvent&)
+  {
+    this->updater_->force_update();
+  }
+
+  /**
+   * Diagnostic task reporting the write queue, throughput and per-stage
+   * timings. Warns if messages were dropped since the last report.
+   */
+  void Diagnose(diagnostic_updater::DiagnosticStatusWrapper& stat)
+  {
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    std::uint64_t written = this->written_;
+    std::uint64_t dropped = this->dropped_;
+    double elapsed =
+      std::chrono::duration<double>(now - this->last_report_).count();
+
+    bool armed = false;
+    std::size_t held = 0;
+    double held_span = 0.0;
+    if (this->black_box_)
+      {
+	std::lock_guard<std::mutex> lock(this->black_box_mutex_);
+	armed = ! this->Recording(now);
+	held = this->black_box_->Size();
+	held_span =
+	  std::chrono::duration<double>(this->black_box_->Span()).count();
+      }
+
+    if (dropped != this->last_dropped_)
+      {
+	stat.summary(diagnostic_msgs::DiagnosticStatus::WARN,
+		     "Messages dropped, the writers are not keeping up");
+      }
+    else if (armed)
+      {
+	stat.summary(diagnostic_msgs::DiagnosticStatus::OK,
+		     "Armed, waiting for a trigger");
+      }
+    else
+      {
+	stat.summary(diagnostic_msgs::DiagnosticStatus::OK, "Writing");
+      }
+
+    stat.addf("Write rate (Hz)", "%.2f", elapsed > 0.0 ?
+	      (written - this->last_written_) / elapsed : 0.0);
+    stat.addf("Queued", "%zu/%zu", this->jobs_->Size(),
+	      this->jobs_->Capacity());
+    stat.add("Written", written);
+    stat.add("Dropped", dropped);
+    if (this->black_box_)
+      {
+	stat.addf("Held", "%zu/%zu", held, this->black_box_->Capacity());
+	stat.addf("Held (s)", "%.2f", held_span);
+	stat.add("Triggers", this->triggers_.load());
+      }
+    this->queue_stats_.Report("queue", stat);
+    this->encode_stats_.Report("encode", stat);
+    this->write_stats_.Report("write", stat);
+
+    this->last_written_ = written;
+    this->last_dropped_ = dropped;
+    this->last_report_ = now;
+  }
+
+private:
+  /**
+   * A message waiting to be written, along with its index in its stream
+   */
+  struct WriteJob
+  {
+    std::string stream;
+    int idx;
+    std::chrono::steady_clock::time_point queued;
+    pcl::PointCloud<o3d3xx::PointT>::ConstPtr cloud;
+    sensor_msgs::Image::ConstPtr im;
+  };
+
+  /**
+   * Takes in a received message: into the black box while one is armed and
+   * not recording, straight to the writers otherwise
+   */
+  void Accept(WriteJob& job)
+  {
+    if (this->black_box_)
+      {
+	std::chrono::steady_clock::time_point now =
+	  std::chrono::steady_clock::now();
+	std::lock_guard<std::mutex> lock(this->black_box_mutex_);
+	if (! this->Recording(now))
+	  {
+	    this->black_box_->Push(std::move(job), now);
+	    return;
+	  }
+      }
+
+    this->Dispatch(job);
+  }
+
+  /**
+   * Fires the black box: queues everything held for writing and records
+   * live messages for the next `post_trigger'. Returns the number of
+   * messages that were held.
+   */
+  std::size_t Fire()
+  {
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(this->black_box_mutex_);
+    std::size_t held = this->black_box_->Size();
+    double span =
+      std::chrono::duration<double>(this->black_box_->Span()).count();
+
+    this->recording_until_ = now + this->post_trigger_;
+    this->black_box_->Drain([this](WriteJob& job) { this->Dispatch(job); });
+    this->triggers_++;
+
+    ROS_INFO("File writer triggered: writing %zu held messages (%.2f s), "
+	     "recording for %.1f s", held, span,
+	     std::chrono::duration<double>(this->post_trigger_).count());
+    return held;
+  }
+
+  /**
+   * Whether live messages are written at `now', i.e., we are within
+   * `post_trigger' of the last trigger. Called with `black_box_mutex_'
+   * held.
+   */
+  bool Recording(std::chrono::steady_clock::time_point now) const
+  {
+    return now < this->recording_until_;
+  }
+
+  /**
+   * Enqueues `job' with the index of its stream
+   */
+  void Dispatch(WriteJob& job)
+  {
+    if (job.cloud)
+      {
+	this->Enqueue(job, this->cloud_idx_, this->cloud_idx_mutex_);
+      }
+    else if (job.stream == "depth")
+      {
+	this->Enqueue(job, this->depth_idx_, this->depth_idx_mutex_);
+      }
+    else if (job.stream == "amplitude")
+      {
+	this->Enqueue(job, this->amplitude_idx_, this->amplitude_idx_mutex_);
+      }
+    else if (job.stream == "confidence")
+      {
+	this->Enqueue(job, this->confidence_idx_,
+		      this->confidence_idx_mutex_);
+      }
+  }
+
+  /**
+   * Hands `job' to the writer threads, numbering it with the next value of
+   * `idx'. Dropped messages do not use up an index, so the files of each
+   * stream stay contiguously numbered.
+   */
+  void Enqueue(WriteJob& job, int& idx, std::mutex& idx_mutex)
+  {
+    bool queued;
+    {
+      std::lock_guard<std::mutex> lock(idx_mutex);
+      job.idx = idx;
+      job.queued = std::chrono::steady_clock::now();
+      queued = this->jobs_->TryPush(job);
+      if (queued)
+	{
+	  idx++;
+	}
+    }
+
+    if (! queued)
+      {
+	this->dropped_++;
+	ROS_WARN_THROTTLE(1.0, "File writer queue full, dropped %s message "
+			  "(%lu dropped so far)", job.stream.c_str(),
+			  (unsigned long) this->dropped_.load());
+	return;
+      }
+
+    std::size_t depth = this->jobs_->Size();
+    std::size_t max_depth = this->max_depth_.load();
+    while ((depth > max_depth) &&
+	   (! this->max_depth_.compare_exchange_weak(max_depth, depth)))
+      { }
+  }
+
+  /**
+   * Body of each writer thread. Keeps draining the queue after `running_'
+   * is cleared, so nothing that was accepted is lost on shutdown. Runs on
+   * `writer_cpus'.
+   *
+   * Of the time a job takes, what the helpers report as `encode' counts as
+   * encoding and the rest as writing; PCL encodes and writes PCD files in
+   * one go, so those count as writing only.
+   */
+  void WriteLoop()
+  {
+    o3d3xx_ros::ConfigureThread("o3d3xx_writer", this->writer_cpus_, 0);
+
+    WriteJob job;
+    std::vector<float> points;
+    std::vector<std::uint8_t> png;
+    for (;;)
+      {
+	if (! this->jobs_->Pop(job, 100))
+	  {
+	    if (! this->running_)
+	      {
+		break;
+	      }
+	    continue;
+	  }
+
+	std::chrono::steady_clock::time_point start =
+	  std::chrono::steady_clock::now();
+	std::chrono::steady_clock::duration encode =
+	  std::chrono::steady_clock::duration::zero();
+	this->queue_stats_.Record(start - job.queued);
+
+	try
+	  {
+	    if (this->segments_)
+	      {
+		this->WriteSegment(job, points, encode);
+	      }
+	    else if (job.cloud)
+	      {
+		this->WriteCloud(*job.cloud, job.idx);
+	      }
+	    else
+	      {
+		this->WriteImage(job.im, job.stream, job.idx, png, encode);
+	      }
+	    this->written_++;
+
+	    if (encode.count() > 0)
+	      {
+		this->encode_stats_.Record(encode);
+	      }
+	    this->write_stats_.Record(
+	      std::chrono::steady_clock::now() - start - encode);
+	  }
+	catch (const std::exception& ex)
+	  {
+	    ROS_ERROR("Failed to write %s %d: %s", job.stream.c_str(),
+		      job.idx, ex.what());
+	  }
+
+	job = WriteJob();
+      }
+  }
+
+  void WriteCloud(const pcl::PointCloud<o3d3xx::PointT>& cloud, int idx)
+  {
+    std::stringstream ss;
+    ss << std::setw(10) << std::setfill('0') << idx;
+    std::string target_file = this->outdir_ + "/cloud/cloud_" + ss.str();
+
+    switch (this->cloud_format_)
+      {
+      case cloud_format::ASCII:
+	pcl::io::savePCDFileASCII(target_file + ".pcd", cloud);
+	break;
+
+      case cloud_format::BINARY:
+	pcl::io::savePCDFileBinary(target_file + ".pcd", cloud);
+	break;
+
+      case cloud_format::BINARY_COMPRESSED:
+	pcl::io::savePCDFileBinaryCompressed(target_file + ".pcd", cloud);
+	break;
+
+      case cloud_format::RAW:
+	this->WriteRawXYZ(target_file + ".raw", cloud);
+	break;
+      }
+  }
+
+  /**
+   * Writes the x, y, z coordinates of each point of `cloud', in row-major
+   * order, as native float32 triples with no header. Throws if the file
+   * cannot be opened or written.
+   */
+  void WriteRawXYZ(const std::string& target_file,
+		   const pcl::PointCloud<o3d3xx::PointT>& cloud)
+  {
+    std::ofstream out(target_file, std::ios::out | std::ios::binary);
+    if (! out)
+      {
+	throw std::runtime_error("Failed to open file: " + target_file);
+      }
+
+    for (auto& pt : cloud.points)
+      {
+	float xyz[3] = {pt.x, pt.y, pt.z};
+	out.write(reinterpret_cast<const char*>(xyz), sizeof(xyz));
+      }
+
+    out.close();
+    if (! out)
+      {
+	throw std::runtime_error("Failed to write file: " + target_file);
+      }
+  }
+
+  /**
+   * Appends `job' to the current segment. Clouds are packed into `points'
+   * first, which is reused from call to call; the time that takes, or the
+   * image conversion takes, is added to `encode'.
+   */
+  void WriteSegment(const WriteJob& job, std::vector<float>& points,
+		    std::chrono::steady_clock::duration& encode)
+  {
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+
+    if (job.cloud)
+      {
+	const pcl::PointCloud<o3d3xx::PointT>& cloud = *job.cloud;
+	points.resize(cloud.points.size() * 4);
+	for (std::size_t i = 0; i < cloud.points.size(); ++i)
+	  {
+	    points[4*i] = cloud.points[i].x;
+	    points[4*i + 1] = cloud.points[i].y;
+	    points[4*i + 2] = cloud.points[i].z;
+	    points[4*i + 3] = cloud.points[i].intensity;
+	  }
+	encode += std::chrono::steady_clock::now() - start;
+
+	// PCL clouds are stamped in microseconds
+	this->segments_->Append(o3d3xx_ros::segment::stream::CLOUD, job.idx,
+				cloud.header.stamp * 1000,
+				cloud.height, cloud.width,
+				cloud.width * 4 * sizeof(float), CV_32FC4,
+				points.data());
+	return;
+      }
+
+    o3d3xx_ros::segment::stream id;
+    if (job.stream == "depth")
+      {
+	id = o3d3xx_ros::segment::stream::DEPTH;
+      }
+    else if (job.stream == "amplitude")
+      {
+	id = o3d3xx_ros::segment::stream::AMPLITUDE;
+      }
+    else
+      {
+	id = o3d3xx_ros::segment::stream::CONFIDENCE;
+      }
+
+    cv::Mat img = O3D3xxFileWriterNode::ToCv(job.im, job.stream)->image;
+    if (! img.isContinuous())
+      {
+	img = img.clone();
+      }
+    encode += std::chrono::steady_clock::now() - start;
+
+    this->segments_->Append(id, job.idx, job.im->header.stamp.toNSec(),
+			    img.rows, img.cols, img.cols * img.elemSize(),
+			    img.type(), img.data);
+  }
+
+  /**
+   * Shares `im' as an OpenCV image of the encoding we write for `im_type'
+   */
+  static cv_bridge::CvImageConstPtr
+  ToCv(const sensor_msgs::Image::ConstPtr& im, const std::string& im_type)
+  {
+    if (im_type == "confidence")
+      {
+	return cv_bridge::toCvShare(im, sensor_msgs::image_encodings::MONO8);
+      }
+
+    return cv_bridge::toCvShare(im, sensor_msgs::image_encodings::MONO16);
+  }
+
+  /**
+   * Writes `im' as a PNG file, and a YAML file with `dump_yaml'. The PNG is
+   * encoded into `png', which is reused from call to call; the time that
+   * takes is added to `encode'.
+   */
+  void WriteImage(const sensor_msgs::Image::ConstPtr& im,
+		  const std::string& im_type, int idx,
+		  std::vector<std::uint8_t>& png,
+		  std::chrono::steady_clock::duration& encode)
+  {
+    std::string target_file =
+      this->outdir_ + "/" + im_type + "/" + im_type + "_";
+    cv_bridge::CvImageConstPtr cv_ptr = O3D3xxFileWriterNode::ToCv(im, im_type);
+
+    std::stringstream ss;
+    ss << std::setw(10) << std::setfill('0') << idx;
+    target_file += ss.str();
+
+    if (this->dump_yaml_)
+      {
+	cv::FileStorage storage(target_file + ".yml",
+				cv::FileStorage::WRITE);
+	storage << "img" << cv_ptr->image;
+	storage.release();
+      }
+
+    std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    if (! cv::imencode(".png", cv_ptr->image, png))
+      {
+	throw std::runtime_error("Failed to encode PNG");
+      }
+    encode += std::chrono::steady_clock::now() - start;
+
+    std::ofstream out(target_file + ".png", std::ios::out | std::ios::binary);
+    out.write(reinterpret_cast<const char*>(png.data()), png.size());
+    if (! out)
+      {
+	throw std::runtime_error("Failed to write file: " + target_file +
+				 ".png");
+      }
+  }
+
+  std::string outdir_;
+  bool dump_yaml_;
+  bool container_;
+  cloud_format cloud_format_;
+  o3d3xx_ros::cloud_encoding cloud_encoding_;
+  std::atomic<bool> running_;
+  ros::Subscriber cloud_sub_;
+  ros::Subscriber depth_sub_;
+  ros::Subscriber amplitude_sub_;
+  ros::Subscriber confidence_sub_;
+
+  int cloud_idx_;
+  int depth_idx_;
+  int amplitude_idx_;
+  int confidence_idx_;
+
+  std::mutex cloud_idx_mutex_;
+  std::mutex depth_idx_mutex_;
+  std::mutex amplitude_idx_mutex_;
+  std::mutex confidence_idx_mutex_;
+
+  std::unique_ptr<o3d3xx_ros::BoundedQueue<WriteJob> > jobs_;
+  std::unique_ptr<o3d3xx_ros::SegmentWriter> segments_;
+  std::vector<std::thread> writers_;
+  std::vector<int> writer_cpus_;
+  std::atomic<std::uint64_t> written_;
+  std::atomic<std::uint64_t> dropped_;
+  std::atomic<std::size_t> max_depth_;
+  ros::Timer stats_timer_;
+
+  // stage timings for the diagnostics
+  o3d3xx_ros::StageStats queue_stats_;
+  o3d3xx_ros::StageStats encode_stats_;
+  o3d3xx_ros::StageStats write_stats_;
+  std::uint64_t last_written_;
+  std::uint64_t last_dropped_;
+  std::chrono::steady_clock::time_point last_report_;
+  std::unique_ptr<diagnostic_updater::Updater> updater_;
+  ros::Timer diag_timer_;
+
+  // black box, unless recording continuously
+  std::unique_ptr<o3d3xx_ros::BlackBox<WriteJob> > black_box_;
+  std::mutex black_box_mutex_;
+  std::chrono::steady_clock::duration post_trigger_;
+  std::chrono::steady_clock::time_point recording_until_;
+  std::atomic<std::uint64_t> triggers_;
+  ros::Subscriber trigger_sub_;
+  ros::ServiceServer trigger_srv_;
+
+}; // end: class O3D3xxFileWriterNode
+
+#endif // __O3D3XX_ROS_O3D3XX_FILE_WRITER_NODE_H__
@@ -0,0 +1,380 @@
+/*
+ * Copyright (C) 2014 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_O3D3XX_NODE_H__
+#define __O3D3XX_ROS_O3D3XX_NODE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <diagnostic_updater/diagnostic_updater.h>
+#include <o3d3xx.h>
+#include <ros/ros.h>
+#include <o3d3xx/GetVersion.h>
+#include <o3d3xx_ros/bounded_queue.h>
+#include <o3d3xx_ros/o3d3xx_camera.h>
+#include <o3d3xx_ros/thread_config.h>
+
+/**
+ * A frame from one of the cameras, queued for the publishing threads.
+ */
+struct O3D3xxFrame
+{
+  std::size_t camera;
+  ros::Time stamp;
+  o3d3xx::ImageBuffer::Ptr buff;
+};
+
+/**
+ * Drives one or more O3D3xx cameras: one acquisition thread per camera
+ * pulls frames, and a pool of worker threads, shared by all cameras,
+ * converts and publishes them.
+ *
+ * All names are resolved relative to the (private) node handle passed to the
+ * constructor which allows the same class to be run standalone by
+ * `o3d3xx_node' or loaded into a nodelet manager by `O3D3xxNodelet'.
+ *
+ * By default a single camera is driven, configured from the parameters of
+ * the node itself. If the `cameras' parameter holds a list of names, one
+ * camera is driven per name, each configured from, and publishing in, the
+ * child namespace of that name (see `O3D3xxCamera').
+ *
+ * Every camera reports its frame rate, timeouts, dropped frames and the
+ * time spent per stage of the frame path (acquire, convert, viz, publish)
+ * on `/diagnostics', once a second.
+ *
+ * Startup is kept short so frames flow as soon as the cameras answer: the
+ * cameras are set up concurrently, since advertising their topics is a
+ * round trip to the master each, and the services only come up once
+ * streaming has started.
+ */
+class O3D3xxNode
+{
+public:
+  O3D3xxNode(ros::NodeHandle nh)
+    : nh_(nh),
+      timeout_millis_(500),
+      num_workers_(1),
+      acquisition_priority_(0),
+      block_on_full_queue_(false),
+      running_(true)
+  {
+    int queue_size;
+    std::string queue_policy;
+    std::vector<std::string> cameras;
+
+    nh.param("timeout_millis", this->timeout_millis_, 500);
+    nh.param("queue_size", queue_size, 2);
+    nh.param("queue_policy", queue_policy, std::string("drop_oldest"));
+    nh.param("num_workers", this->num_workers_, 1);
+    nh.param("cameras", cameras, std::vector<std::string>());
+    nh.param("acquisition_cpus", this->acquisition_cpus_, std::vector<int>());
+    nh.param("acquisition_priority", this->acquisition_priority_, 0);
+    nh.param("worker_cpus", this->worker_cpus_, std::vector<int>());
+
+    o3d3xx_ros::CheckCpus(this->acquisition_cpus_, "acquisition_cpus");
+    o3d3xx_ros::CheckPriority(this->acquisition_priority_,
+			      "acquisition_priority");
+    o3d3xx_ros::CheckCpus(this->worker_cpus_, "worker_cpus");
+
+    if (queue_policy == "block")
+      {
+	this->block_on_full_queue_ = true;
+      }
+    else if (queue_policy != "drop_oldest")
+      {
+	throw std::runtime_error("Invalid queue_policy: " + queue_policy);
+      }
+
+    queue_size = std::max(queue_size, 1);
+    this->num_workers_ = std::max(this->num_workers_, 1);
+
+    if (cameras.empty())
+      {
+	cameras.push_back("");
+      }
+
+    //------------------------------------------
+    // Hand-off between acquisition and workers
+    //------------------------------------------
+    this->frames_.reset(
+      new o3d3xx_ros::BoundedQueue<O3D3xxFrame>(queue_size * cameras.size()));
+
+    //----------------------
+    // Cameras
+    //----------------------
+
+    // room for a buffer in every queue slot, every worker and the one being
+    // acquired into, so steady state does not allocate
+    std::size_t free_buffers =
+      this->frames_->Capacity() + this->num_workers_ + 1;
+
+    // one thread per camera, so a hundred cameras start about as fast as
+    // one; the first error, if any, is rethrown once all are done
+    this->cameras_.resize(cameras.size());
+    std::vector<std::exception_ptr> errors(cameras.size());
+    std::vector<std::thread> setup;
+    for (std::size_t i = 0; i < cameras.size(); ++i)
+      {
+	setup.emplace_back(
+	  [this, &nh, &cameras, &errors, free_buffers, i]()
+	  {
+	    try
+	      {
+		this->cameras_[i].reset(
+		  new O3D3xxCamera(nh, cameras[i], free_buffers));
+	      }
+	    catch (...)
+	      {
+		errors[i] = std::current_exception();
+	      }
+	  });
+      }
+
+    for (auto& thread : setup)
+      {
+	thread.join();
+      }
+
+    for (auto& error : errors)
+      {
+	if (error)
+	  {
+	    std::rethrow_exception(error);
+	  }
+      }
+
+    //----------------------
+    // Diagnostics
+    //----------------------
+    this->updater_.reset(
+      new diagnostic_updater::Updater(ros::NodeHandle(), nh));
+    this->updater_->setHardwareID("o3d3xx");
+    for (auto& camera : this->cameras_)
+      {
+	this->updater_->add(camera->Name(), camera.get(),
+			    &O3D3xxCamera::Diagnose);
+      }
+
+    this->diag_timer_ =
+      nh.createTimer(ros::Duration(1.0), &O3D3xxNode::DiagnosticsCb, this);
+  }
+
+  /**
+   * Main loop. Blocks until ROS shuts down or `Stop()' is called.
+   *
+   * Each camera gets a thread that pulls frames from it and hands them off,
+   * through a queue of `queue_size' frames per camera, to `num_workers'
+   * threads which do the conversion and publishing. This way a slow
+   * subscriber never holds up `WaitForFrame'. With more than one worker,
+   * frames may be published out of order.
+   *
+   * The acquisition threads run on `acquisition_cpus' and, if
+   * `acquisition_priority' is set, with real-time priority, so frames are
+   * picked up on time however busy the rest of the machine is; the workers
+   * run on `worker_cpus'.
+   *
+   * Frames no topic is going to publish, for lack of subscribers or because
+   * of `max_rate', are dropped right after they are received, before they
+   * cost any conversion work.
+   *
+   * The services are advertised once these threads are running, so the
+   * first frames do not wait for them. `GetVersion' is not serviced from
+   * here, the caller is responsible for spinning the callback queue of the
+   * node handle.
+   */
+  void Run()
+  {
+    std::vector<std::thread> acquisition;
+    for (std::size_t i = 0; i < this->cameras_.size(); ++i)
+      {
+	acquisition.emplace_back(&O3D3xxNode::AcquisitionLoop, this, i);
+      }
+
+    std::vector<std::thread> workers;
+    for (int i = 0; i < this->num_workers_; ++i)
+      {
+	workers.emplace_back(&O3D3xxNode::PublishLoop, this);
+      }
+
+    //----------------------
+    // Advertised services
+    //----------------------
+    for (auto& camera : this->cameras_)
+      {
+	camera->StartServices();
+      }
+
+    this->version_srv_ =
+      this->nh_.advertiseService<o3d3xx::GetVersion::Request,
+				 o3d3xx::GetVersion::Response>
+      ("/GetVersion", std::bind(&O3D3xxNode::GetVersion, this,
+				std::placeholders::_1,
+				std::placeholders::_2));
+
+    for (auto& thread : acquisition)
+      {
+	thread.join();
+      }
+
+    for (auto& worker : workers)
+      {
+	worker.join();
+      }
+  }
+
+  /**
+   * Asks the main loop to exit after the current frame.
+   */
+  void Stop()
+  {
+    this->running_ = false;
+  }
+
+  /**
+   * Implements the `GetVersion' service.
+   *
+   * The `GetVersion' service will return the version string of the underlying
+   * libo3d3xx library.
+   */
+  bool GetVersion(o3d3xx::GetVersion::Request &req,
+		  o3d3xx::GetVersion::Response &res)
+  {
+    int major, minor, patch;
+    o3d3xx::version(&major, &minor, &patch);
+
+    std::ostringstream ss;
+    ss << O3D3XX_LIBRARY_NAME
+       << ": " << major << "." << minor << "." << patch;
+
+    res.version = ss.str();
+    return true;
+  }
+
+  /**
+   * Publishes the diagnostics of all cameras
+   */
+  void DiagnosticsCb(const ros::TimerEvent&)
+  {
+    this->updater_->force_update();
+  }
+
+
+private:
+  /**
+   * Pulls frames from camera `idx' and queues them for the workers.
+   */
+  void AcquisitionLoop(std::size_t idx)
+  {
+    o3d3xx_ros::ConfigureThread("o3d3xx_acq" + std::to_string(idx),
+				this->acquisition_cpus_,
+				this->acquisition_priority_);
+
+    O3D3xxCamera& camera = *(this->cameras_[idx]);
+    O3D3xxFrame frame;
+    O3D3xxFrame stale;
+    frame.camera = idx;
+
+    while (ros::ok() && this->running_)
+      {
+	if (! frame.buff)
+	  {
+	    frame.buff = camera.GetBuffer();
+	  }
+
+	if (! camera.WaitForFrame(frame.buff.get(), frame.stamp))
+	  {
+	    continue;
+	  }
+
+	// throttled, unsubscribed or static: keep the buffer for the next frame
+	if (! camera.Wanted(frame.buff, frame.stamp))
+	  {
+	    continue;
+	  }
+
+	if (this->block_on_full_queue_)
+	  {
+	    while ((! this->frames_->Push(frame, this->timeout_millis_)) &&
+		   ros::ok() && this->running_)
+	      { }
+	  }
+	else
+	  {
+	    while (! this->frames_->TryPush(frame))
+	      {
+		if (this->frames_->TryPop(stale))
+		  {
+		    this->cameras_[stale.camera]->FrameDropped();
+		    this->cameras_[stale.camera]->Recycle(stale.buff);
+		  }
+	      }
+	  }
+
+	frame.buff.reset();
+      }
+  }
+
+  /**
+   * Converts and publishes the frames queued by the acquisition threads.
+   */
+  void PublishLoop()
+  {
+    o3d3xx_ros::ConfigureThread("o3d3xx_worker", this->worker_cpus_, 0);
+
+    std::vector<O3D3xxCamera::Scratch> scratch(this->cameras_.size());
+    O3D3xxFrame frame;
+
+    while (ros::ok() && this->running_)
+      {
+	if (! this->frames_->Pop(frame, this->timeout_millis_))
+	  {
+	    continue;
+	  }
+
+	O3D3xxCamera& camera = *(this->cameras_[frame.camera]);
+	camera.Publish(frame.buff, frame.stamp, scratch[frame.camera]);
+	camera.Recycle(frame.buff);
+      }
+  }
+
+  ros::NodeHandle nh_;
+  int timeout_millis_;
+  int num_workers_;
+  std::vector<int> acquisition_cpus_;
+  int acquisition_priority_;
+  std::vector<int> worker_cpus_;
+  bool block_on_full_queue_;
+  std::atomic<bool> running_;
+
+  std::vector<std::unique_ptr<O3D3xxCamera> > cameras_;
+  std::unique_ptr<o3d3xx_ros::BoundedQueue<O3D3xxFrame> > frames_;
+
+  std::unique_ptr<diagnostic_updater::Updater> updater_;
+  ros::Timer diag_timer_;
+  ros::ServiceServer version_srv_;
+
+}; // end: class O3D3xxNode
+
+#endif // __O3D3XX_ROS_O3D3XX_NODE_H__
@@ -0,0 +1,484 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_O3D3XX_PLAYBACK_NODE_H__
+#define __O3D3XX_ROS_O3D3XX_PLAYBACK_NODE_H__
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/filesystem.hpp>
+#include <image_transport/image_transport.h>
+#include <o3d3xx/image.h>
+#include <o3d3xx/UnitVectors.h>
+#include <o3d3xx_ros/image_pool.h>
+#include <o3d3xx_ros/message_pool.h>
+#include <o3d3xx_ros/metadata_cache.h>
+#include <o3d3xx_ros/segment.h>
+#include <o3d3xx_ros/unit_vectors.h>
+#include <opencv2/opencv.hpp>
+#include <pcl_ros/point_cloud.h>
+#include <ros/ros.h>
+#include <sensor_msgs/Image.h>
+#include <sensor_msgs/image_encodings.h>
+
+/**
+ * Republishes a recording made by `O3D3xxFileWriterNode' in `container'
+ * mode on the same topics `O3D3xxNode' publishes them on.
+ *
+ * The segments are memory mapped, so each payload is copied once, straight
+ * from the page cache into a pooled outgoing message.
+ *
+ * With `cloud_source' set to `unit_vectors', frames recorded without a
+ * cloud get one rebuilt from their depth, confidence and amplitude and the
+ * rays in the `unit_vectors' file a camera saved in its `cache_dir'. A
+ * recording then need not carry the cloud, by far its largest stream.
+ */
+class O3D3xxPlaybackNode
+{
+public:
+  O3D3xxPlaybackNode(ros::NodeHandle nh)
+    : rate_(1.0),
+      loop_(false),
+      restamp_(false),
+      running_(true),
+      first_stamp_(0)
+  {
+    std::string indir;
+    nh.param("indir", indir, std::string("/tmp/o3d3xx-ros/data"));
+    nh.param("rate", this->rate_, 1.0);
+    nh.param("loop", this->loop_, false);
+    nh.param("restamp", this->restamp_, false);
+    nh.param("frame_id", this->frame_id_, nh.getNamespace() + "_link");
+
+    std::string cloud_source;
+    std::string unit_vectors;
+    nh.param("cloud_source", cloud_source, std::string("camera"));
+    nh.param("unit_vectors", unit_vectors, std::string(""));
+
+    if (this->rate_ < 0.0)
+      {
+	throw std::runtime_error("rate must not be negative");
+      }
+
+    if (o3d3xx_ros::ParseCloudSource(cloud_source) ==
+	o3d3xx_ros::cloud_source::UNIT_VECTORS)
+      {
+	o3d3xx::UnitVectorsPtr rays(new o3d3xx::UnitVectors());
+	if ((! o3d3xx_ros::MetadataCache::LoadUnitVectorsFile(unit_vectors,
+							       *rays)) ||
+	    (! rays->complete))
+	  {
+	    throw std::runtime_error("No complete unit vectors in: " +
+				     unit_vectors);
+	  }
+	this->rays_ = rays;
+      }
+
+    // the file writer puts its segments in a subdirectory of `outdir'
+    std::string dir = indir;
+    if (boost::filesystem::is_directory(indir + "/segments"))
+      {
+	dir = indir + "/segments";
+      }
+
+    if (! boost::filesystem::is_directory(dir))
+      {
+	throw std::runtime_error("Not a directory: " + dir);
+      }
+
+    for (boost::filesystem::directory_iterator it(dir), end;
+	 it != end; ++it)
+      {
+	if (it->path().extension().string() == o3d3xx_ros::segment::EXTENSION)
+	  {
+	    this->segments_.push_back(it->path().string());
+	  }
+      }
+
+    if (this->segments_.empty())
+      {
+	throw std::runtime_error("No segments found in: " + dir);
+      }
+
+    std::sort(this->segments_.begin(), this->segments_.end());
+
+    //-----------------------------------------------------
+    // Published topics, named like those of `O3D3xxNode'
+    //-----------------------------------------------------
+    image_transport::ImageTransport it(nh);
+    this->cloud_pub_ =
+      nh.advertise<pcl::PointCloud<o3d3xx::PointT> >("/cloud", 1);
+    this->depth_pub_ = it.advertise("/depth", 1);
+    this->amplitude_pub_ = it.advertise("/amplitude", 1);
+    this->conf_pub_ = it.advertise("/confidence", 1);
+  }
+
+  /**
+   * Plays the recording, once or, with `loop', until `Stop' is called.
+   *
+   * Records are published `rate' times as fast as they were recorded, as
+   * told by their time stamps. A `rate' of 0 publishes them as fast as
+   * possible.
+   */
+  void Run()
+  {
+    do
+      {
+	for (auto& path : this->segments_)
+	  {
+	    if (! (this->running_ && ros::ok()))
+	      {
+		return;
+	      }
+
+	    try
+	      {
+		o3d3xx_ros::SegmentReader reader(path);
+		ROS_INFO("Playing %s (%zu records)", path.c_str(),
+			 reader.Index().size());
+		this->Play(reader);
+	      }
+	    catch (const std::exception& ex)
+	      {
+		ROS_ERROR("Skipping %s: %s", path.c_str(), ex.what());
+	      }
+	  }
+
+	// timing restarts with the next pass
+	this->first_stamp_ = 0;
+      }
+    while (this->loop_ && this->running_ && ros::ok());
+  }
+
+  void Stop()
+  {
+    this->running_ = false;
+  }
+
+private:
+  void Play(const o3d3xx_ros::SegmentReader& reader)
+  {
+    // several writer threads may have appended slightly out of order
+    std::vector<o3d3xx_ros::segment::IndexEntry> index = reader.Index();
+    std::stable_sort(index.begin(), index.end(),
+		     [](const o3d3xx_ros::segment::IndexEntry& a,
+			const o3d3xx_ros::segment::IndexEntry& b)
+		     { return a.stamp < b.stamp; });
+
+    // the records of a frame share its stamp, so they are adjacent now
+    FrameRecords frame;
+    for (auto& entry : index)
+      {
+	if (! (this->running_ && ros::ok()))
+	  {
+	    return;
+	  }
+
+	if (entry.stamp != frame.stamp)
+	  {
+	    this->RebuildCloud(frame);
+	    frame = FrameRecords();
+	    frame.stamp = entry.stamp;
+	  }
+
+	this->WaitFor(entry.stamp);
+
+	const o3d3xx_ros::segment::RecordHeader& hdr = reader.Header(entry);
+	const std::uint8_t* payload = reader.Payload(entry);
+
+	ros::Time stamp;
+	if (this->restamp_)
+	  {
+	    stamp = ros::Time::now();
+	  }
+	else
+	  {
+	    stamp.fromNSec(hdr.stamp);
+	  }
+
+	frame.Add(hdr, payload, stamp);
+	switch (static_cast<o3d3xx_ros::segment::stream>(hdr.stream))
+	  {
+	  case o3d3xx_ros::segment::stream::CLOUD:
+	    this->PublishCloud(hdr, payload, stamp);
+	    break;
+
+	  case o3d3xx_ros::segment::stream::DEPTH:
+	    this->PublishImage(this->depth_pub_, this->depth_pool_,
+			       hdr, payload, stamp);
+	    break;
+
+	  case o3d3xx_ros::segment::stream::AMPLITUDE:
+	    this->PublishImage(this->amplitude_pub_, this->amplitude_pool_,
+			       hdr, payload, stamp);
+	    break;
+
+	  case o3d3xx_ros::segment::stream::CONFIDENCE:
+	    this->PublishImage(this->conf_pub_, this->conf_pool_,
+			       hdr, payload, stamp);
+	    break;
+
+	  default:
+	    ROS_WARN_THROTTLE(1.0, "Skipping record of unknown stream %u",
+			      hdr.stream);
+	    break;
+	  }
+      }
+
+    this->RebuildCloud(frame);
+  }
+
+  /**
+   * The records of one frame, as far as `RebuildCloud' is concerned. The
+   * payloads point into the mapped segment.
+   */
+  struct FrameRecords
+  {
+    FrameRecords()
+      : stamp(0),
+	cloud(false)
+    { }
+
+    void Add(const o3d3xx_ros::segment::RecordHeader& hdr,
+	     const std::uint8_t* payload, const ros::Time& at)
+    {
+      switch (static_cast<o3d3xx_ros::segment::stream>(hdr.stream))
+	{
+	case o3d3xx_ros::segment::stream::CLOUD:
+	  this->cloud = true;
+	  break;
+
+	case o3d3xx_ros::segment::stream::DEPTH:
+	  this->depth = FrameRecords::Wrap(hdr, payload);
+	  this->depth_stamp = at;
+	  break;
+
+	case o3d3xx_ros::segment::stream::AMPLITUDE:
+	  this->amplitude = FrameRecords::Wrap(hdr, payload);
+	  break;
+
+	case o3d3xx_ros::segment::stream::CONFIDENCE:
+	  this->confidence = FrameRecords::Wrap(hdr, payload);
+	  break;
+
+	default:
+	  break;
+	}
+    }
+
+    static cv::Mat Wrap(const o3d3xx_ros::segment::RecordHeader& hdr,
+			const std::uint8_t* payload)
+    {
+      return cv::Mat(hdr.height, hdr.width, hdr.type,
+		     const_cast<std::uint8_t*>(payload), hdr.step);
+    }
+
+    std::uint64_t stamp;
+    bool cloud;
+    cv::Mat depth;
+    cv::Mat amplitude;
+    cv::Mat confidence;
+    ros::Time depth_stamp;
+  };
+
+  /**
+   * With `cloud_source' unit_vectors, publishes the cloud of a `frame'
+   * recorded with depth and confidence but without one, stamped like its
+   * depth
+   */
+  void RebuildCloud(const FrameRecords& frame)
+  {
+    if ((! this->rays_) || frame.cloud || frame.depth.empty() ||
+	frame.confidence.empty() ||
+	(this->cloud_pub_.getNumSubscribers() == 0))
+      {
+	return;
+      }
+
+    pcl::PointCloud<o3d3xx::PointT>::Ptr cloud = this->cloud_pool_.Get();
+    if (! o3d3xx_ros::ReconstructCloud(*this->rays_, frame.depth,
+				       frame.amplitude, frame.confidence,
+				       *cloud))
+      {
+	ROS_WARN_THROTTLE(1.0, "Skipping cloud: the unit vectors are for "
+			  "%ux%u images, the recording is %dx%d",
+			  this->rays_->width, this->rays_->height,
+			  frame.depth.cols, frame.depth.rows);
+	return;
+      }
+
+    cloud->header.frame_id = this->frame_id_;
+    cloud->header.stamp = frame.depth_stamp.toNSec() / 1000;
+    this->cloud_pub_.publish(cloud);
+  }
+
+  /**
+   * Sleeps until a record stamped `stamp' is due
+   */
+  void WaitFor(std::uint64_t stamp)
+  {
+    if (this->rate_ <= 0.0)
+      {
+	return;
+      }
+
+    std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+
+    if ((this->first_stamp_ == 0) || (stamp < this->first_stamp_))
+      {
+	this->first_stamp_ = stamp;
+	this->start_ = now;
+	return;
+      }
+
+    std::chrono::nanoseconds delay(
+      static_cast<std::int64_t>((stamp - this->first_stamp_) / this->rate_));
+    std::chrono::steady_clock::time_point due =
+      this->start_ +
+      std::chrono::duration_cast<std::chrono::steady_clock::duration>(delay);
+
+    // in slices, so long gaps in a recording do not hold up shutdown
+    while ((due > now) && this->running_ && ros::ok())
+      {
+	std::this_thread::sleep_until(
+	  std::min(due, now + std::chrono::milliseconds(100)));
+	now = std::chrono::steady_clock::now();
+      }
+  }
+
+  void PublishCloud(const o3d3xx_ros::segment::RecordHeader& hdr,
+		    const std::uint8_t* payload, const ros::Time& stamp)
+  {
+    if (this->cloud_pub_.getNumSubscribers() == 0)
+      {
+	return;
+      }
+
+    if (hdr.type != CV_32FC4)
+      {
+	ROS_WARN_THROTTLE(1.0, "Skipping cloud of unexpected type %d",
+			  hdr.type);
+	return;
+      }
+
+    pcl::PointCloud<o3d3xx::PointT>::Ptr cloud = this->cloud_pool_.Get();
+    cloud->header.frame_id = this->frame_id_;
+    cloud->header.stamp = stamp.toNSec() / 1000;
+    cloud->height = hdr.height;
+    cloud->width = hdr.width;
+    cloud->points.resize(static_cast<std::size_t>(hdr.height) * hdr.width);
+
+    // segments do not record it, so it is recomputed from the points
+    bool dense = true;
+
+    for (std::uint32_t row = 0; row < hdr.height; ++row)
+      {
+	const float* xyzi =
+	  reinterpret_cast<const float*>(payload + row * hdr.step);
+	o3d3xx::PointT* pt = &cloud->points[row * hdr.width];
+
+	for (std::uint32_t col = 0; col < hdr.width; ++col, xyzi += 4, ++pt)
+	  {
+	    pt->x = xyzi[0];
+	    pt->y = xyzi[1];
+	    pt->z = xyzi[2];
+	    pt->intensity = xyzi[3];
+	    dense = dense && std::isfinite(pt->x) && std::isfinite(pt->y) &&
+	      std::isfinite(pt->z);
+	  }
+      }
+    cloud->is_dense = dense;
+
+    this->cloud_pub_.publish(cloud);
+  }
+
+  void PublishImage(image_transport::Publisher& pub,
+		    o3d3xx_ros::ImagePool& pool,
+		    const o3d3xx_ros::segment::RecordHeader& hdr,
+		    const std::uint8_t* payload, const ros::Time& stamp)
+  {
+    if (pub.getNumSubscribers() == 0)
+      {
+	return;
+      }
+
+    std::string encoding;
+    if (hdr.type == CV_16UC1)
+      {
+	encoding = sensor_msgs::image_encodings::MONO16;
+      }
+    else if (hdr.type == CV_8UC1)
+      {
+	encoding = sensor_msgs::image_encodings::MONO8;
+      }
+    else
+      {
+	ROS_WARN_THROTTLE(1.0, "Skipping image of unexpected type %d",
+			  hdr.type);
+	return;
+      }
+
+    sensor_msgs::ImagePtr msg =
+      pool.Get(hdr.height, hdr.width, hdr.type, encoding);
+    std::size_t row_bytes = std::min<std::size_t>(msg->step, hdr.step);
+    for (std::uint32_t row = 0; row < hdr.height; ++row)
+      {
+	std::memcpy(msg->data.data() + row * msg->step,
+		    payload + row * hdr.step, row_bytes);
+      }
+
+    msg->header.frame_id = this->frame_id_;
+    msg->header.stamp = stamp;
+    pub.publish(msg);
+  }
+
+  double rate_;
+  bool loop_;
+  bool restamp_;
+  std::atomic<bool> running_;
+  std::string frame_id_;
+  std::vector<std::string> segments_;
+
+  // with `cloud_source' unit_vectors, the rays the clouds are rebuilt from
+  o3d3xx::UnitVectorsConstPtr rays_;
+
+  std::uint64_t first_stamp_;
+  std::chrono::steady_clock::time_point start_;
+
+  o3d3xx_ros::MessagePool<pcl::PointCloud<o3d3xx::PointT> > cloud_pool_;
+  o3d3xx_ros::ImagePool depth_pool_;
+  o3d3xx_ros::ImagePool amplitude_pool_;
+  o3d3xx_ros::ImagePool conf_pool_;
+
+  ros::Publisher cloud_pub_;
+  image_transport::Publisher depth_pub_;
+  image_transport::Publisher amplitude_pub_;
+  image_transport::Publisher conf_pub_;
+
+}; // end: class O3D3xxPlaybackNode
+
+#endif // __O3D3XX_ROS_O3D3XX_PLAYBACK_NODE_H__
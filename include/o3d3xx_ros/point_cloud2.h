@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_POINT_CLOUD2_H__
+#define __O3D3XX_ROS_POINT_CLOUD2_H__
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <o3d3xx/image.h>
+#include <pcl/point_cloud.h>
+#include <sensor_msgs/PointCloud2.h>
+#include <sensor_msgs/PointField.h>
+
+namespace o3d3xx_ros
+{
+  /**
+   * How the `cloud' topic is put on the wire
+   */
+  enum class cloud_encoding : int
+  {
+    PCL = 0,     // pcl::PointCloud<o3d3xx::PointT>, with its padding
+    FLOAT32 = 1, // x, y, z, intensity as packed float32, 16 bytes/point
+    INT16 = 2    // x, y, z as int16 mm, intensity as uint16, 8 bytes/point
+  };
+
+  /**
+   * What the x, y and z fields of an invalid (non-finite) point hold with
+   * the int16 encoding. Real coordinates saturate at -32767 mm, so no point
+   * of the camera's range is ever mistaken for one.
+   */
+  const std::int16_t CLOUD_INT16_INVALID =
+    std::numeric_limits<std::int16_t>::min();
+
+  inline cloud_encoding ParseCloudEncoding(const std::string& name)
+  {
+    if (name == "pcl")
+      {
+	return cloud_encoding::PCL;
+      }
+    else if (name == "float32")
+      {
+	return cloud_encoding::FLOAT32;
+      }
+    else if (name == "int16")
+      {
+	return cloud_encoding::INT16;
+      }
+
+    throw std::runtime_error("Invalid cloud_encoding: " + name);
+  }
+
+  /**
+   * Fills `msg' with the points of `cloud', keeping its organization, as
+   * tightly packed `x', `y', `z' and `intensity' fields of the type given
+   * by `encoding' (which must not be `PCL'). The header of `msg' is left
+   * alone.
+   *
+   * With `INT16', invalid points are written as `CLOUD_INT16_INVALID' and
+   * taken back to NaN by `UnpackCloud'; `is_dense' is cleared if there are
+   * any.
+   *
+   * The field layout is only rebuilt when it changes, so filling a recycled
+   * message does not allocate.
+   */
+  inline void PackCloud(const pcl::PointCloud<o3d3xx::PointT>& cloud,
+			cloud_encoding encoding, sensor_msgs::PointCloud2& msg)
+  {
+    const bool int16 = (encoding == cloud_encoding::INT16);
+    const std::uint32_t size = int16 ? 2 : 4;
+    const std::uint8_t xyz_type = int16 ?
+      sensor_msgs::PointField::INT16 : sensor_msgs::PointField::FLOAT32;
+    const std::uint8_t i_type = int16 ?
+      sensor_msgs::PointField::UINT16 : sensor_msgs::PointField::FLOAT32;
+
+    if ((msg.fields.size() != 4) || (msg.point_step != 4 * size) ||
+	(msg.fields[0].datatype != xyz_type))
+      {
+	static const char* names[4] = {"x", "y", "z", "intensity"};
+	msg.fields.resize(4);
+	for (std::uint32_t i = 0; i < 4; ++i)
+	  {
+	    msg.fields[i].name = names[i];
+	    msg.fields[i].offset = i * size;
+	    msg.fields[i].datatype = i < 3 ? xyz_type : i_type;
+	    msg.fields[i].count = 1;
+	  }
+	msg.point_step = 4 * size;
+      }
+
+    const std::uint16_t one = 1;
+    msg.is_bigendian = *reinterpret_cast<const std::uint8_t*>(&one) == 0;
+    msg.height = cloud.height;
+    msg.width = cloud.width;
+    msg.row_step = msg.width * msg.point_step;
+    msg.is_dense = cloud.is_dense;
+    msg.data.resize(cloud.points.size() * msg.point_step);
+
+    if (! int16)
+      {
+	float* out = reinterpret_cast<float*>(msg.data.data());
+	for (auto& pt : cloud.points)
+	  {
+	    out[0] = pt.x;
+	    out[1] = pt.y;
+	    out[2] = pt.z;
+	    out[3] = pt.intensity;
+	    out += 4;
+	  }
+	return;
+      }
+
+    // meters to millimeters, saturating short of the invalid marker
+    auto mm = [](float v) -> std::int16_t
+      {
+	float r = std::round(v * 1000.0f);
+	return r >= 32767.0f ? 32767 :
+	  (r <= -32767.0f ? -32767 : static_cast<std::int16_t>(r));
+      };
+
+    std::uint8_t* out = msg.data.data();
+    for (auto& pt : cloud.points)
+      {
+	std::int16_t xyz[3] =
+	  {CLOUD_INT16_INVALID, CLOUD_INT16_INVALID, CLOUD_INT16_INVALID};
+	if (std::isfinite(pt.x) && std::isfinite(pt.y) && std::isfinite(pt.z))
+	  {
+	    xyz[0] = mm(pt.x);
+	    xyz[1] = mm(pt.y);
+	    xyz[2] = mm(pt.z);
+	  }
+	else
+	  {
+	    msg.is_dense = false;
+	  }
+
+	std::uint16_t intensity =
+	  (! std::isfinite(pt.intensity) || (pt.intensity <= 0.0f)) ? 0 :
+	  (pt.intensity >= 65535.0f ? 65535 :
+	   static_cast<std::uint16_t>(pt.intensity + 0.5f));
+
+	std::memcpy(out, xyz, sizeof(xyz));
+	std::memcpy(out + sizeof(xyz), &intensity, sizeof(intensity));
+	out += 8;
+      }
+  }
+
+  /**
+   * Fills `cloud' with the points of `msg', as packed by `PackCloud' with
+   * either `FLOAT32' or `INT16', keeping its organization. Invalid int16
+   * points become NaN. The header of `cloud' is left alone. Returns false,
+   * leaving `cloud' alone, if `msg' is not laid out that way.
+   */
+  inline bool UnpackCloud(const sensor_msgs::PointCloud2& msg,
+			  pcl::PointCloud<o3d3xx::PointT>& cloud)
+  {
+    static const char* names[4] = {"x", "y", "z", "intensity"};
+    if (msg.fields.size() != 4)
+      {
+	return false;
+      }
+
+    const bool int16 =
+      msg.fields[0].datatype == sensor_msgs::PointField::INT16;
+    const std::uint32_t size = int16 ? 2 : 4;
+    const std::uint16_t one = 1;
+    const bool bigendian = *reinterpret_cast<const std::uint8_t*>(&one) == 0;
+    std::size_t n = static_cast<std::size_t>(msg.height) * msg.width;
+
+    for (std::uint32_t i = 0; i < 4; ++i)
+      {
+	std::uint8_t type = int16 ?
+	  (i < 3 ? sensor_msgs::PointField::INT16 :
+	   sensor_msgs::PointField::UINT16) :
+	  sensor_msgs::PointField::FLOAT32;
+	if ((msg.fields[i].name != names[i]) ||
+	    (msg.fields[i].offset != i * size) ||
+	    (msg.fields[i].datatype != type))
+	  {
+	    return false;
+	  }
+      }
+
+    if ((msg.point_step != 4 * size) ||
+	(msg.row_step != msg.width * msg.point_step) ||
+	(msg.data.size() != n * msg.point_step) ||
+	(msg.is_bigendian != bigendian))
+      {
+	return false;
+      }
+
+    cloud.points.resize(n);
+    cloud.height = msg.height;
+    cloud.width = msg.width;
+    cloud.is_dense = msg.is_dense;
+
+    if (! int16)
+      {
+	const float* in = reinterpret_cast<const float*>(msg.data.data());
+	for (auto& pt : cloud.points)
+	  {
+	    pt.x = in[0];
+	    pt.y = in[1];
+	    pt.z = in[2];
+	    pt.intensity = in[3];
+	    in += 4;
+	  }
+	return true;
+      }
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const std::uint8_t* in = msg.data.data();
+    for (auto& pt : cloud.points)
+      {
+	std::int16_t xyz[3];
+	std::uint16_t intensity;
+	std::memcpy(xyz, in, sizeof(xyz));
+	std::memcpy(&intensity, in + sizeof(xyz), sizeof(intensity));
+	in += 8;
+
+	if (xyz[0] == CLOUD_INT16_INVALID)
+	  {
+	    pt.x = pt.y = pt.z = nan;
+	  }
+	else
+	  {
+	    pt.x = xyz[0] / 1000.0f;
+	    pt.y = xyz[1] / 1000.0f;
+	    pt.z = xyz[2] / 1000.0f;
+	  }
+	pt.intensity = intensity;
+      }
+    return true;
+  }
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_POINT_CLOUD2_H__
@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_RATE_LIMITER_H__
+#define __O3D3XX_ROS_RATE_LIMITER_H__
+
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <ros/ros.h>
+
+namespace o3d3xx_ros
+{
+  /**
+   * Decides, by their time stamps, which frames of a stream to let through
+   * so that on average at most `max_rate' per second are.
+   *
+   * Frames are let through on a fixed grid of one per period rather than a
+   * period after the last one, so a camera running at 30 Hz throttled to
+   * 10 Hz yields 10 Hz, not 7.5 Hz, despite jitter. After a gap, or if the
+   * stamps go backwards, the grid restarts at the next frame.
+   *
+   * May be shared by several threads.
+   */
+  class RateLimiter
+  {
+  public:
+    /**
+     * A `max_rate' of 0 lets everything through
+     */
+    explicit RateLimiter(double max_rate = 0.0)
+      : period_(0),
+	next_(0)
+    {
+      this->SetRate(max_rate);
+    }
+
+    void SetRate(double max_rate)
+    {
+      if (max_rate < 0.0)
+	{
+	  throw std::runtime_error("max_rate must not be negative");
+	}
+
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      this->period_ = max_rate > 0.0 ?
+	static_cast<std::int64_t>(1e9 / max_rate) : 0;
+    }
+
+    double Rate() const
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      return this->period_ > 0 ? 1e9 / this->period_ : 0.0;
+    }
+
+    /**
+     * True if a frame stamped `stamp' would be let through
+     */
+    bool Ready(const ros::Time& stamp) const
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      return this->ReadyLocked(stamp.toNSec());
+    }
+
+    /**
+     * Lets a frame stamped `stamp' through if it is due, in which case the
+     * next one is only due a period later. Returns whether it was.
+     */
+    bool Take(const ros::Time& stamp)
+    {
+      std::int64_t t = stamp.toNSec();
+
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      if (! this->ReadyLocked(t))
+	{
+	  return false;
+	}
+
+      if (this->period_ > 0)
+	{
+	  bool on_grid = (this->next_ > 0) && (t >= this->next_) &&
+	    (t - this->next_ < this->period_);
+	  this->next_ = (on_grid ? this->next_ : t) + this->period_;
+	}
+      return true;
+    }
+
+  private:
+    bool ReadyLocked(std::int64_t t) const
+    {
+      return (this->period_ == 0) || (this->next_ == 0) ||
+	(t >= this->next_) || (t < this->next_ - 2 * this->period_);
+    }
+
+    mutable std::mutex mutex_;
+    std::int64_t period_;
+    std::int64_t next_;
+
+  }; // end: class RateLimiter
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_RATE_LIMITER_H__
@@ -0,0 +1,174 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_RAY_ORIGIN_H__
+#define __O3D3XX_ROS_RAY_ORIGIN_H__
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <o3d3xx/image.h>
+#include <opencv2/opencv.hpp>
+#include <pcl/point_cloud.h>
+
+/**
+ * The camera's depth is radial: the distance of each point from the origin
+ * of the pixel rays, which is the translation of the camera's extrinsic
+ * calibration and generally not (0, 0, 0). Anything that moves a point to a
+ * new depth has to move it along its ray, i.e., about that origin.
+ */
+namespace o3d3xx_ros
+{
+  /**
+   * Whether a point of the cloud, with its depth and confidence, measures
+   * its ray
+   */
+  inline bool RayValid(const o3d3xx::PointT& pt, std::uint16_t depth,
+		       std::uint8_t confidence)
+  {
+    return ((confidence & 1) == 0) && (depth != 0) &&
+      std::isfinite(pt.x) && std::isfinite(pt.y) && std::isfinite(pt.z);
+  }
+
+  namespace detail
+  {
+    /**
+     * Gaussian elimination with partial pivoting. Returns false if `a' is
+     * singular.
+     */
+    inline bool Solve4(double a[4][4], double b[4], double x[4])
+    {
+      for (int col = 0; col < 4; ++col)
+	{
+	  int pivot = col;
+	  for (int r = col + 1; r < 4; ++r)
+	    {
+	      if (std::fabs(a[r][col]) > std::fabs(a[pivot][col]))
+		{
+		  pivot = r;
+		}
+	    }
+
+	  if (std::fabs(a[pivot][col]) < 1e-12)
+	    {
+	      return false;
+	    }
+
+	  for (int k = 0; k < 4; ++k)
+	    {
+	      std::swap(a[col][k], a[pivot][k]);
+	    }
+	  std::swap(b[col], b[pivot]);
+
+	  for (int r = col + 1; r < 4; ++r)
+	    {
+	      double f = a[r][col] / a[col][col];
+	      for (int k = col; k < 4; ++k)
+		{
+		  a[r][k] -= f * a[col][k];
+		}
+	      b[r] -= f * b[col];
+	    }
+	}
+
+      for (int r = 3; r >= 0; --r)
+	{
+	  double sum = b[r];
+	  for (int k = r + 1; k < 4; ++k)
+	    {
+	      sum -= a[r][k] * x[k];
+	    }
+	  x[r] = sum / a[r][r];
+	}
+      return true;
+    }
+
+  } // end: namespace detail
+
+  /**
+   * Finds the origin of the rays of a frame from its organized `cloud', in
+   * meters, and its CV_16UC1 `depth', in millimeters, and CV_8UC1
+   * `confidence' images, into `origin'.
+   *
+   * Since |p - o| = depth for every valid point p, 2 p.o - o.o = p.p -
+   * depth^2, which is linear in (o, o.o), is solved in the least squares
+   * sense. Returns false, leaving `origin' alone, if the frame does not
+   * determine it.
+   */
+  inline bool FitRayOrigin(const pcl::PointCloud<o3d3xx::PointT>& cloud,
+			   const cv::Mat& depth, const cv::Mat& confidence,
+			   float origin[3])
+  {
+    std::size_t n = depth.total();
+    if ((depth.type() != CV_16UC1) || (n == 0) ||
+	(confidence.total() != n) || (cloud.points.size() != n))
+      {
+	return false;
+      }
+
+    double ata[4][4] = {{0.0}};
+    double atb[4] = {0.0};
+    std::size_t used = 0;
+
+    for (int r = 0; r < depth.rows; ++r)
+      {
+	const std::uint16_t* d = depth.ptr<std::uint16_t>(r);
+	const std::uint8_t* c = confidence.ptr<std::uint8_t>(r);
+
+	for (int col = 0; col < depth.cols; ++col)
+	  {
+	    const o3d3xx::PointT& pt =
+	      cloud.points[static_cast<std::size_t>(r) * depth.cols + col];
+	    if (! RayValid(pt, d[col], c[col]))
+	      {
+		continue;
+	      }
+
+	    double meters = d[col] / 1000.0;
+	    double a[4] = {2.0 * pt.x, 2.0 * pt.y, 2.0 * pt.z, -1.0};
+	    double b = static_cast<double>(pt.x) * pt.x +
+	      static_cast<double>(pt.y) * pt.y +
+	      static_cast<double>(pt.z) * pt.z - meters * meters;
+
+	    for (int j = 0; j < 4; ++j)
+	      {
+		for (int k = 0; k < 4; ++k)
+		  {
+		    ata[j][k] += a[j] * a[k];
+		  }
+		atb[j] += a[j] * b;
+	      }
+	    used++;
+	  }
+      }
+
+    double o[4];
+    if ((used < 4) || (! detail::Solve4(ata, atb, o)))
+      {
+	return false;
+      }
+
+    for (int i = 0; i < 3; ++i)
+      {
+	origin[i] = static_cast<float>(o[i]);
+      }
+    return true;
+  }
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_RAY_ORIGIN_H__
@@ -0,0 +1,297 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_RVL_H__
+#define __O3D3XX_ROS_RVL_H__
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * Lossless coding of 16-bit images after A. D. Wilson, "Fast Lossless Depth
+ * Image Compression" (RVL), which is cheap enough to run at full frame rate
+ * on a fraction of a core.
+ *
+ * The pixels are coded, in order, as alternating runs: the length of a run
+ * of zeros, the length of the following run of non-zero pixels, then, for
+ * each of those, the difference to the previous non-zero pixel, zigzag coded
+ * so small differences of either sign are small numbers. Every number is
+ * written in 3-bit groups, least significant first, as nibbles whose top bit
+ * tells whether another one follows. Nibbles fill 32-bit words from the top
+ * down and the words are stored little-endian; the last is padded with zero
+ * nibbles.
+ *
+ * Zeroing the pixels the camera flagged invalid turns their noise into runs
+ * of zeros, which is where most of the gain on depth images comes from.
+ */
+namespace o3d3xx_ros
+{
+  namespace rvl
+  {
+    const std::string ENCODING = "rvl";
+
+    /**
+     * An upper bound on the coded size of `n' pixels, in bytes
+     */
+    inline std::size_t MaxSize(std::size_t n)
+    {
+      return 5 * n + 8;
+    }
+
+    namespace detail
+    {
+      class NibbleWriter
+      {
+      public:
+	explicit NibbleWriter(std::uint8_t* out)
+	  : begin_(out),
+	    out_(out),
+	    word_(0),
+	    nibbles_(0)
+	{ }
+
+	void Put(std::uint32_t value)
+	{
+	  do
+	    {
+	      std::uint32_t nibble = value & 0x7;
+	      value >>= 3;
+	      if (value != 0)
+		{
+		  nibble |= 0x8;
+		}
+
+	      this->word_ = (this->word_ << 4) | nibble;
+	      if (++this->nibbles_ == 8)
+		{
+		  this->Flush();
+		}
+	    }
+	  while (value != 0);
+	}
+
+	/**
+	 * Writes out the last, partial word. Returns the bytes written.
+	 */
+	std::size_t Finish()
+	{
+	  if (this->nibbles_ > 0)
+	    {
+	      this->word_ <<= 4 * (8 - this->nibbles_);
+	      this->Flush();
+	    }
+
+	  return this->out_ - this->begin_;
+	}
+
+      private:
+	void Flush()
+	{
+	  this->out_[0] = static_cast<std::uint8_t>(this->word_);
+	  this->out_[1] = static_cast<std::uint8_t>(this->word_ >> 8);
+	  this->out_[2] = static_cast<std::uint8_t>(this->word_ >> 16);
+	  this->out_[3] = static_cast<std::uint8_t>(this->word_ >> 24);
+	  this->out_ += 4;
+	  this->word_ = 0;
+	  this->nibbles_ = 0;
+	}
+
+	std::uint8_t* begin_;
+	std::uint8_t* out_;
+	std::uint32_t word_;
+	int nibbles_;
+
+      }; // end: class NibbleWriter
+
+      class NibbleReader
+      {
+      public:
+	NibbleReader(const std::uint8_t* in, std::size_t size)
+	  : in_(in),
+	    end_(in + size),
+	    word_(0),
+	    nibbles_(0)
+	{ }
+
+	/**
+	 * Reads the next number. Returns false if the data ran out or the
+	 * number does not fit in 32 bits.
+	 */
+	bool Get(std::uint32_t& value)
+	{
+	  value = 0;
+	  for (int shift = 0; shift < 32; shift += 3)
+	    {
+	      if (this->nibbles_ == 0)
+		{
+		  if (this->end_ - this->in_ < 4)
+		    {
+		      return false;
+		    }
+
+		  this->word_ = static_cast<std::uint32_t>(this->in_[0]) |
+		    (static_cast<std::uint32_t>(this->in_[1]) << 8) |
+		    (static_cast<std::uint32_t>(this->in_[2]) << 16) |
+		    (static_cast<std::uint32_t>(this->in_[3]) << 24);
+		  this->in_ += 4;
+		  this->nibbles_ = 8;
+		}
+
+	      std::uint32_t nibble = this->word_ >> 28;
+	      this->word_ <<= 4;
+	      this->nibbles_--;
+
+	      value |= (nibble & 0x7) << shift;
+	      if ((nibble & 0x8) == 0)
+		{
+		  return true;
+		}
+	    }
+
+	  return false;
+	}
+
+      private:
+	const std::uint8_t* in_;
+	const std::uint8_t* end_;
+	std::uint32_t word_;
+	int nibbles_;
+
+      }; // end: class NibbleReader
+
+      template<bool MASK>
+      inline std::size_t Encode(const std::uint16_t* in,
+				const std::uint8_t* invalid, std::size_t n,
+				std::uint8_t* out)
+      {
+	auto at = [in, invalid](std::size_t i) -> std::uint16_t
+	  {
+	    return (MASK && (invalid[i] & 1)) ? 0 : in[i];
+	  };
+
+	NibbleWriter writer(out);
+	std::int32_t previous = 0;
+	std::size_t i = 0;
+
+	while (i < n)
+	  {
+	    std::size_t j = i;
+	    while ((j < n) && (at(j) == 0))
+	      {
+		++j;
+	      }
+	    writer.Put(j - i);
+	    i = j;
+
+	    while ((j < n) && (at(j) != 0))
+	      {
+		++j;
+	      }
+	    writer.Put(j - i);
+
+	    for (; i < j; ++i)
+	      {
+		std::int32_t current = at(i);
+		std::int32_t delta = current - previous;
+		writer.Put(delta >= 0 ?
+			   static_cast<std::uint32_t>(delta) << 1 :
+			   (static_cast<std::uint32_t>(-delta) << 1) - 1);
+		previous = current;
+	      }
+	  }
+
+	return writer.Finish();
+      }
+
+    } // end: namespace detail
+
+    /**
+     * Codes the `n' pixels of `in' into `out', which is resized to fit. If
+     * `invalid' is given, it has a byte per pixel, and pixels whose byte has
+     * bit 0 set are coded as 0.
+     *
+     * `out' only ever grows, so coding into a recycled buffer does not
+     * allocate.
+     */
+    inline void Encode(const std::uint16_t* in, const std::uint8_t* invalid,
+		       std::size_t n, std::vector<std::uint8_t>& out)
+    {
+      out.resize(MaxSize(n));
+      std::size_t size = invalid != nullptr ?
+	detail::Encode<true>(in, invalid, n, out.data()) :
+	detail::Encode<false>(in, invalid, n, out.data());
+      out.resize(size);
+    }
+
+    /**
+     * Decodes `size' bytes of `in' into the `n' pixels of `out'. Returns
+     * false if `in' is not a valid coding of `n' pixels.
+     */
+    inline bool Decode(const std::uint8_t* in, std::size_t size,
+		       std::uint16_t* out, std::size_t n)
+    {
+      detail::NibbleReader reader(in, size);
+      std::int32_t previous = 0;
+      std::size_t i = 0;
+
+      while (i < n)
+	{
+	  std::uint32_t zeros, nonzeros;
+	  if ((! reader.Get(zeros)) || (zeros > n - i))
+	    {
+	      return false;
+	    }
+	  std::fill(out + i, out + i + zeros, 0);
+	  i += zeros;
+
+	  if ((! reader.Get(nonzeros)) || (nonzeros > n - i))
+	    {
+	      return false;
+	    }
+
+	  for (std::uint32_t k = 0; k < nonzeros; ++k)
+	    {
+	      std::uint32_t zigzag;
+	      if (! reader.Get(zigzag))
+		{
+		  return false;
+		}
+
+	      std::int64_t delta = (zigzag & 1) ?
+		-static_cast<std::int64_t>((zigzag >> 1) + 1) :
+		static_cast<std::int64_t>(zigzag >> 1);
+	      std::int64_t current = previous + delta;
+	      if ((current <= 0) || (current > 0xffff))
+		{
+		  return false;
+		}
+
+	      out[i++] = static_cast<std::uint16_t>(current);
+	      previous = static_cast<std::int32_t>(current);
+	    }
+	}
+
+      return true;
+    }
+
+  } // end: namespace rvl
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_RVL_H__
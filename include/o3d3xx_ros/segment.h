@@ -0,0 +1,473 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_SEGMENT_H__
+#define __O3D3XX_ROS_SEGMENT_H__
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * Segment files hold any number of frames of several streams appended one
+ * after the other, so a recording is a handful of large files rather than
+ * one file per frame per stream.
+ *
+ * Layout (all integers native-endian):
+ *
+ *   SegmentHeader
+ *   { RecordHeader, payload, padding } ...
+ *   IndexEntry ...
+ *   SegmentTrailer
+ *
+ * Every record header and payload starts on an 8 byte boundary, so a mapped
+ * segment can be read in place. The trailer at the very end of the file
+ * locates the index; a segment whose writer died before writing the index
+ * can still be read by walking the records from the front.
+ */
+namespace o3d3xx_ros
+{
+  namespace segment
+  {
+    const char FILE_MAGIC[8] = {'O','3','D','S','E','G','0','1'};
+    const char INDEX_MAGIC[8] = {'O','3','D','I','D','X','0','1'};
+    const std::uint32_t VERSION = 1;
+    const std::string EXTENSION = ".o3dseg";
+
+    /**
+     * The stream a record belongs to
+     */
+    enum class stream : std::uint32_t
+    {
+      CLOUD = 0,
+      DEPTH = 1,
+      AMPLITUDE = 2,
+      CONFIDENCE = 3
+    };
+
+    struct SegmentHeader
+    {
+      char magic[8];
+      std::uint32_t version;
+      std::uint32_t reserved;
+    };
+
+    /**
+     * Precedes each payload. The payload is `height' rows of `step' bytes
+     * of elements of OpenCV type `type'. Clouds are stored as CV_32FC4,
+     * i.e., x, y, z, intensity per point.
+     */
+    struct RecordHeader
+    {
+      std::uint32_t stream;
+      std::uint32_t idx;
+      std::uint64_t stamp; // nanoseconds
+      std::uint32_t height;
+      std::uint32_t width;
+      std::uint32_t step;
+      std::int32_t type;
+      std::uint64_t size; // payload bytes, not counting padding
+    };
+
+    struct IndexEntry
+    {
+      std::uint64_t offset; // of the record header
+      std::uint64_t stamp;
+      std::uint32_t stream;
+      std::uint32_t idx;
+    };
+
+    struct SegmentTrailer
+    {
+      std::uint64_t index_offset;
+      std::uint64_t count;
+      char magic[8];
+    };
+
+    inline std::uint64_t Padding(std::uint64_t size)
+    {
+      return (8 - (size % 8)) % 8;
+    }
+
+  } // end: namespace segment
+
+  /**
+   * Appends records to a series of segment files named
+   * `segment_NNNNNN.o3dseg' in a directory. A new segment is started once
+   * the current one exceeds `max_bytes' or has been open for `max_seconds'
+   * (0 disables either limit).
+   *
+   * `Append' may be called from several threads. Write errors are thrown as
+   * `std::runtime_error'.
+   */
+  class SegmentWriter
+  {
+  public:
+    SegmentWriter(const std::string& dir, std::uint64_t max_bytes,
+		  double max_seconds)
+      : dir_(dir),
+	max_bytes_(max_bytes),
+	max_seconds_(max_seconds),
+	seq_(0),
+	offset_(0),
+	buff_(1 << 20)
+    { }
+
+    ~SegmentWriter()
+    {
+      try
+	{
+	  std::lock_guard<std::mutex> lock(this->mutex_);
+	  this->Close();
+	}
+      catch (const std::exception&)
+	{ }
+    }
+
+    SegmentWriter(const SegmentWriter&) = delete;
+    SegmentWriter& operator=(const SegmentWriter&) = delete;
+
+    void Append(segment::stream stream, std::uint32_t idx,
+		std::uint64_t stamp, std::uint32_t height, std::uint32_t width,
+		std::uint32_t step, std::int32_t type, const void* data)
+    {
+      std::lock_guard<std::mutex> lock(this->mutex_);
+
+      if (! this->out_.is_open())
+	{
+	  this->Open();
+	}
+
+      segment::RecordHeader hdr;
+      hdr.stream = static_cast<std::uint32_t>(stream);
+      hdr.idx = idx;
+      hdr.stamp = stamp;
+      hdr.height = height;
+      hdr.width = width;
+      hdr.step = step;
+      hdr.type = type;
+      hdr.size = static_cast<std::uint64_t>(height) * step;
+
+      segment::IndexEntry entry;
+      entry.offset = this->offset_;
+      entry.stamp = stamp;
+      entry.stream = hdr.stream;
+      entry.idx = idx;
+
+      static const char zeros[8] = {0};
+      this->Write(&hdr, sizeof(hdr));
+      this->Write(data, hdr.size);
+      this->Write(zeros, segment::Padding(hdr.size));
+      this->index_.push_back(entry);
+
+      if (((this->max_bytes_ > 0) && (this->offset_ >= this->max_bytes_)) ||
+	  ((this->max_seconds_ > 0.0) &&
+	   (std::chrono::duration<double>(
+	      std::chrono::steady_clock::now() - this->opened_).count() >=
+	    this->max_seconds_)))
+	{
+	  this->Close();
+	}
+    }
+
+  private:
+    void Open()
+    {
+      std::stringstream ss;
+      ss << this->dir_ << "/segment_" << std::setw(6) << std::setfill('0')
+	 << this->seq_++ << segment::EXTENSION;
+      this->path_ = ss.str();
+
+      this->out_.rdbuf()->pubsetbuf(this->buff_.data(), this->buff_.size());
+      this->out_.open(this->path_,
+		      std::ios::out | std::ios::binary | std::ios::trunc);
+      if (! this->out_)
+	{
+	  throw std::runtime_error("Could not open segment: " + this->path_);
+	}
+
+      this->offset_ = 0;
+      this->index_.clear();
+      this->opened_ = std::chrono::steady_clock::now();
+
+      segment::SegmentHeader hdr;
+      std::memcpy(hdr.magic, segment::FILE_MAGIC, sizeof(hdr.magic));
+      hdr.version = segment::VERSION;
+      hdr.reserved = 0;
+      this->Write(&hdr, sizeof(hdr));
+    }
+
+    void Close()
+    {
+      if (! this->out_.is_open())
+	{
+	  return;
+	}
+
+      segment::SegmentTrailer trailer;
+      trailer.index_offset = this->offset_;
+      trailer.count = this->index_.size();
+      std::memcpy(trailer.magic, segment::INDEX_MAGIC, sizeof(trailer.magic));
+
+      this->Write(this->index_.data(),
+		  this->index_.size() * sizeof(segment::IndexEntry));
+      this->Write(&trailer, sizeof(trailer));
+      this->out_.close();
+
+      if (! this->out_)
+	{
+	  throw std::runtime_error("Failed to close segment: " + this->path_);
+	}
+    }
+
+    void Write(const void* data, std::uint64_t size)
+    {
+      if (size == 0)
+	{
+	  return;
+	}
+
+      this->out_.write(reinterpret_cast<const char*>(data), size);
+      if (! this->out_)
+	{
+	  throw std::runtime_error("Failed to write segment: " + this->path_);
+	}
+      this->offset_ += size;
+    }
+
+    std::string dir_;
+    std::uint64_t max_bytes_;
+    double max_seconds_;
+    int seq_;
+
+    std::mutex mutex_;
+    std::string path_;
+    std::ofstream out_;
+    std::uint64_t offset_;
+    std::vector<segment::IndexEntry> index_;
+    std::chrono::steady_clock::time_point opened_;
+    std::vector<char> buff_;
+
+  }; // end: class SegmentWriter
+
+  /**
+   * Read-only memory mapping of one segment file. Record payloads are
+   * returned as pointers into the mapping, so nothing is read from disk
+   * until it is touched.
+   *
+   * Throws `std::runtime_error' if the file cannot be mapped or is not a
+   * segment.
+   */
+  class SegmentReader
+  {
+  public:
+    explicit SegmentReader(const std::string& path)
+      : path_(path),
+	data_(nullptr),
+	size_(0)
+    {
+      int fd = open(path.c_str(), O_RDONLY);
+      if (fd < 0)
+	{
+	  throw std::runtime_error("Could not open segment: " + path);
+	}
+
+      struct stat st;
+      if (fstat(fd, &st) == 0)
+	{
+	  this->size_ = st.st_size;
+	}
+
+      if (this->size_ >= sizeof(segment::SegmentHeader))
+	{
+	  void* addr =
+	    mmap(nullptr, this->size_, PROT_READ, MAP_PRIVATE, fd, 0);
+	  if (addr != MAP_FAILED)
+	    {
+	      this->data_ = static_cast<const std::uint8_t*>(addr);
+	      madvise(addr, this->size_, MADV_SEQUENTIAL);
+	    }
+	}
+      close(fd);
+
+      if (this->data_ == nullptr)
+	{
+	  throw std::runtime_error("Could not map segment: " + path);
+	}
+
+      if (std::memcmp(this->data_, segment::FILE_MAGIC,
+		      sizeof(segment::FILE_MAGIC)) != 0)
+	{
+	  this->Unmap();
+	  throw std::runtime_error("Not a segment: " + path);
+	}
+
+      if (! this->ReadIndex())
+	{
+	  this->ScanRecords();
+	}
+    }
+
+    ~SegmentReader()
+    {
+      this->Unmap();
+    }
+
+    SegmentReader(const SegmentReader&) = delete;
+    SegmentReader& operator=(const SegmentReader&) = delete;
+
+    const std::string& Path() const
+    {
+      return this->path_;
+    }
+
+    /**
+     * Index of the records, in the order they were written
+     */
+    const std::vector<segment::IndexEntry>& Index() const
+    {
+      return this->index_;
+    }
+
+    const segment::RecordHeader& Header(const segment::IndexEntry& entry) const
+    {
+      return *reinterpret_cast<const segment::RecordHeader*>(
+	this->data_ + entry.offset);
+    }
+
+    const std::uint8_t* Payload(const segment::IndexEntry& entry) const
+    {
+      return this->data_ + entry.offset + sizeof(segment::RecordHeader);
+    }
+
+  private:
+    /**
+     * Reads the index written at close time. Returns false if the trailer is
+     * missing or inconsistent.
+     */
+    bool ReadIndex()
+    {
+      if (this->size_ <
+	  sizeof(segment::SegmentHeader) + sizeof(segment::SegmentTrailer))
+	{
+	  return false;
+	}
+
+      segment::SegmentTrailer trailer;
+      std::memcpy(&trailer,
+		  this->data_ + this->size_ - sizeof(segment::SegmentTrailer),
+		  sizeof(trailer));
+
+      if ((std::memcmp(trailer.magic, segment::INDEX_MAGIC,
+		       sizeof(trailer.magic)) != 0) ||
+	  (trailer.index_offset +
+	   trailer.count * sizeof(segment::IndexEntry) +
+	   sizeof(segment::SegmentTrailer) != this->size_))
+	{
+	  return false;
+	}
+
+      this->index_.resize(trailer.count);
+      std::memcpy(this->index_.data(), this->data_ + trailer.index_offset,
+		  trailer.count * sizeof(segment::IndexEntry));
+
+      for (auto& entry : this->index_)
+	{
+	  if (! this->Valid(entry.offset, trailer.index_offset))
+	    {
+	      this->index_.clear();
+	      return false;
+	    }
+	}
+
+      return true;
+    }
+
+    /**
+     * Rebuilds the index by walking the records of a segment that was never
+     * closed, stopping at the first truncated one.
+     */
+    void ScanRecords()
+    {
+      this->index_.clear();
+      std::uint64_t offset = sizeof(segment::SegmentHeader);
+
+      while (this->Valid(offset, this->size_))
+	{
+	  const segment::RecordHeader* hdr =
+	    reinterpret_cast<const segment::RecordHeader*>(this->data_ + offset);
+
+	  segment::IndexEntry entry;
+	  entry.offset = offset;
+	  entry.stamp = hdr->stamp;
+	  entry.stream = hdr->stream;
+	  entry.idx = hdr->idx;
+	  this->index_.push_back(entry);
+
+	  offset += sizeof(segment::RecordHeader) + hdr->size +
+	    segment::Padding(hdr->size);
+	}
+    }
+
+    /**
+     * Whether a complete record starts at `offset' and ends before `end'
+     */
+    bool Valid(std::uint64_t offset, std::uint64_t end) const
+    {
+      if ((offset % 8 != 0) ||
+	  (offset + sizeof(segment::RecordHeader) > end))
+	{
+	  return false;
+	}
+
+      const segment::RecordHeader* hdr =
+	reinterpret_cast<const segment::RecordHeader*>(this->data_ + offset);
+
+      return (hdr->size == static_cast<std::uint64_t>(hdr->height) * hdr->step)
+	&& (hdr->size <= end - offset - sizeof(segment::RecordHeader));
+    }
+
+    void Unmap()
+    {
+      if (this->data_ != nullptr)
+	{
+	  munmap(const_cast<std::uint8_t*>(this->data_), this->size_);
+	  this->data_ = nullptr;
+	}
+    }
+
+    std::string path_;
+    const std::uint8_t* data_;
+    std::uint64_t size_;
+    std::vector<segment::IndexEntry> index_;
+
+  }; // end: class SegmentReader
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_SEGMENT_H__
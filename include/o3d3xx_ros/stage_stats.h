@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_STAGE_STATS_H__
+#define __O3D3XX_ROS_STAGE_STATS_H__
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <diagnostic_updater/diagnostic_updater.h>
+
+namespace o3d3xx_ros
+{
+  /**
+   * Rolling statistics of how long one stage of the frame path takes, over
+   * its last `window' runs.
+   *
+   * Recording is a lock and a store into a preallocated ring, cheap enough
+   * to do for every frame from any number of threads; the percentiles are
+   * only worked out when reported.
+   */
+  class StageStats
+  {
+  public:
+    /**
+     * Percentiles of the durations in the window, in milliseconds
+     */
+    struct Summary
+    {
+      std::size_t count;
+      double p50;
+      double p90;
+      double p99;
+      double max;
+    };
+
+    explicit StageStats(std::size_t window = 256)
+      : samples_(std::max<std::size_t>(window, 1)),
+	next_(0),
+	count_(0)
+    { }
+
+    void Record(std::chrono::steady_clock::duration elapsed)
+    {
+      std::int64_t ns =
+	std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+      std::lock_guard<std::mutex> lock(this->mutex_);
+      this->samples_[this->next_] = ns;
+      this->next_ = (this->next_ + 1) % this->samples_.size();
+      this->count_ = std::min(this->count_ + 1, this->samples_.size());
+    }
+
+    Summary Summarize() const
+    {
+      std::vector<std::int64_t> sorted;
+      {
+	std::lock_guard<std::mutex> lock(this->mutex_);
+	sorted.assign(this->samples_.begin(),
+		      this->samples_.begin() + this->count_);
+      }
+
+      Summary s = {sorted.size(), 0.0, 0.0, 0.0, 0.0};
+      if (sorted.empty())
+	{
+	  return s;
+	}
+
+      std::sort(sorted.begin(), sorted.end());
+      auto at = [&sorted](double q) -> double
+	{
+	  std::size_t i = static_cast<std::size_t>(q * (sorted.size() - 1));
+	  return sorted[i] / 1e6;
+	};
+
+      s.p50 = at(0.5);
+      s.p90 = at(0.9);
+      s.p99 = at(0.99);
+      s.max = sorted.back() / 1e6;
+      return s;
+    }
+
+    /**
+     * Adds the summary to `stat' as the `<stage> (ms)' key
+     */
+    void Report(const std::string& stage,
+		diagnostic_updater::DiagnosticStatusWrapper& stat) const
+    {
+      Summary s = this->Summarize();
+      if (s.count == 0)
+	{
+	  stat.add(stage + " (ms)", "no samples");
+	  return;
+	}
+
+      stat.addf(stage + " (ms)", "p50 %.3f, p90 %.3f, p99 %.3f, max %.3f",
+		s.p50, s.p90, s.p99, s.max);
+    }
+
+  private:
+    mutable std::mutex mutex_;
+    std::vector<std::int64_t> samples_;
+    std::size_t next_;
+    std::size_t count_;
+
+  }; // end: class StageStats
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_STAGE_STATS_H__
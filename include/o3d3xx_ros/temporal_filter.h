@@ -0,0 +1,292 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_TEMPORAL_FILTER_H__
+#define __O3D3XX_ROS_TEMPORAL_FILTER_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <o3d3xx/image.h>
+#include <opencv2/opencv.hpp>
+#include <pcl/point_cloud.h>
+#include <o3d3xx_ros/ray_origin.h>
+
+namespace o3d3xx_ros
+{
+  enum class temporal_mode : int
+  {
+    NONE = 0,
+    EMA = 1,   // exponential moving average
+    MEDIAN = 2 // median over a window of frames
+  };
+
+  inline temporal_mode ParseTemporalMode(const std::string& name)
+  {
+    if (name == "none")
+      {
+	return temporal_mode::NONE;
+      }
+    else if (name == "ema")
+      {
+	return temporal_mode::EMA;
+      }
+    else if (name == "median")
+      {
+	return temporal_mode::MEDIAN;
+      }
+
+    throw std::runtime_error("Invalid temporal_filter: " + name);
+  }
+
+  /**
+   * Smooths the depth of a stream of frames over time, in place.
+   *
+   * `ema' keeps an exponential moving average per pixel, weighting the
+   * newest frame by `alpha'. A pixel's average restarts at the new depth
+   * when it differs from it by more than `reset' millimeters (0 never
+   * restarts), so moving edges are not smeared. `median' replaces each depth
+   * by the median over the last `window' frames.
+   *
+   * Only valid pixels (bit 0 of their confidence clear, depth not 0) go into
+   * the history and get filtered; invalid pixels are passed through and
+   * reset the pixel's history. The points of the organized cloud are moved
+   * along their ray so they match the filtered, radial, depth: about the
+   * rays' origin, which is fitted (see `FitRayOrigin') from the first frame
+   * that determines it. Until then only the depth is filtered and the cloud
+   * is left alone.
+   *
+   * The history is counted in frames; see `Restart' to bound it in time.
+   *
+   * All state is allocated on the first frame (and again if the image size
+   * changes). The average, and moving the points, are plain arithmetic and
+   * selects on contiguous rows so the compiler can vectorize them. The
+   * median history is stored pixel-major, the `window' samples of a pixel
+   * side by side, so a pixel's samples share a cache line.
+   *
+   * A filter is not thread-safe, and must see the frames in order.
+   */
+  class TemporalFilter
+  {
+  public:
+    TemporalFilter(temporal_mode m, double alpha, int window, int reset)
+      : mode_(m),
+	alpha_(static_cast<float>(alpha)),
+	window_(window),
+	reset_(static_cast<float>(reset)),
+	next_(0),
+	origin_known_(false)
+    {
+      if ((alpha <= 0.0) || (alpha > 1.0))
+	{
+	  throw std::runtime_error("temporal_alpha must be in (0, 1]");
+	}
+
+      if ((window < 1) || (window > 15))
+	{
+	  throw std::runtime_error("temporal_window must be in [1, 15]");
+	}
+
+      if (reset < 0)
+	{
+	  throw std::runtime_error("temporal_reset must not be negative");
+	}
+    }
+
+    bool Enabled() const
+    {
+      return this->mode_ != temporal_mode::NONE;
+    }
+
+    /**
+     * Forgets the history of every pixel, so the next frame is passed
+     * through and starts it over. The rays' origin is kept.
+     */
+    void Restart()
+    {
+      std::fill(this->avg_.begin(), this->avg_.end(), 0.0f);
+      std::fill(this->history_.begin(), this->history_.end(), 0);
+      this->next_ = 0;
+    }
+
+    /**
+     * Filters the CV_16UC1 `depth' in place, moving the points of `cloud'
+     * along with it if it has a point per pixel. `confidence' is the
+     * CV_8UC1 confidence image of the same frame.
+     */
+    void Apply(cv::Mat& depth, const cv::Mat& confidence,
+	       pcl::PointCloud<o3d3xx::PointT>& cloud)
+    {
+      if ((this->mode_ == temporal_mode::NONE) ||
+	  (depth.type() != CV_16UC1) ||
+	  (confidence.total() != depth.total()))
+	{
+	  return;
+	}
+
+      std::size_t n = depth.total();
+      if (this->filtered_.size() != n)
+	{
+	  this->avg_.assign(n, 0.0f);
+	  this->history_.assign(n * this->window_, 0);
+	  this->filtered_.resize(n);
+	  this->scale_.resize(n);
+	  this->next_ = 0;
+	  this->origin_known_ = false;
+	}
+
+      bool move = cloud.points.size() == n;
+      if (move && (! this->origin_known_))
+	{
+	  // from the unfiltered depth, which the points still agree with
+	  this->origin_known_ =
+	    FitRayOrigin(cloud, depth, confidence, this->origin_);
+	}
+
+      for (int r = 0; r < depth.rows; ++r)
+	{
+	  std::size_t off = static_cast<std::size_t>(r) * depth.cols;
+	  std::uint16_t* d = depth.ptr<std::uint16_t>(r);
+	  const std::uint8_t* c = confidence.ptr<std::uint8_t>(r);
+
+	  if (this->mode_ == temporal_mode::EMA)
+	    {
+	      this->Average(d, c, off, depth.cols);
+	    }
+	  else
+	    {
+	      this->Median(d, c, off, depth.cols);
+	    }
+
+	  // move the points, then store the depth
+	  float* scale = this->scale_.data() + off;
+	  const std::uint16_t* f = this->filtered_.data() + off;
+	  for (int col = 0; col < depth.cols; ++col)
+	    {
+	      scale[col] = d[col] > 0 ?
+		static_cast<float>(f[col]) / d[col] : 1.0f;
+	      d[col] = f[col];
+	    }
+	}
+
+      this->next_ = (this->next_ + 1) % this->window_;
+
+      if (move && this->origin_known_)
+	{
+	  // p' = o + s (p - o)
+	  const float* scale = this->scale_.data();
+	  const float ox = this->origin_[0];
+	  const float oy = this->origin_[1];
+	  const float oz = this->origin_[2];
+	  for (std::size_t i = 0; i < n; ++i)
+	    {
+	      o3d3xx::PointT& pt = cloud.points[i];
+	      pt.x = ox + scale[i] * (pt.x - ox);
+	      pt.y = oy + scale[i] * (pt.y - oy);
+	      pt.z = oz + scale[i] * (pt.z - oz);
+	    }
+	}
+    }
+
+  private:
+    void Average(const std::uint16_t* d, const std::uint8_t* c,
+		 std::size_t off, int cols)
+    {
+      float* avg = this->avg_.data() + off;
+      std::uint16_t* f = this->filtered_.data() + off;
+      float alpha = this->alpha_;
+      float reset = this->reset_ > 0.0f ? this->reset_ : INFINITY;
+
+      for (int col = 0; col < cols; ++col)
+	{
+	  float depth = d[col];
+	  float a = avg[col];
+	  bool valid = ((c[col] & 1) == 0) && (d[col] != 0);
+	  bool fresh = (a == 0.0f) || (std::fabs(depth - a) > reset);
+
+	  a = fresh ? depth : a + alpha * (depth - a);
+	  avg[col] = valid ? a : 0.0f;
+	  f[col] = valid ? static_cast<std::uint16_t>(a + 0.5f) : d[col];
+	}
+    }
+
+    void Median(const std::uint16_t* d, const std::uint8_t* c,
+		std::size_t off, int cols)
+    {
+      int window = this->window_;
+      std::uint16_t* hist = this->history_.data() + off * window;
+      std::uint16_t* f = this->filtered_.data() + off;
+      std::uint16_t samples[15];
+
+      for (int col = 0; col < cols; ++col, hist += window)
+	{
+	  bool valid = ((c[col] & 1) == 0) && (d[col] != 0);
+	  if (! valid)
+	    {
+	      std::fill(hist, hist + window, 0);
+	      f[col] = d[col];
+	      continue;
+	    }
+
+	  hist[this->next_] = d[col];
+
+	  // insertion sort of the valid samples, zeros are unfilled slots
+	  int k = 0;
+	  for (int s = 0; s < window; ++s)
+	    {
+	      std::uint16_t v = hist[s];
+	      if (v == 0)
+		{
+		  continue;
+		}
+
+	      int j = k++;
+	      for (; (j > 0) && (samples[j - 1] > v); --j)
+		{
+		  samples[j] = samples[j - 1];
+		}
+	      samples[j] = v;
+	    }
+
+	  f[col] = samples[k / 2];
+	}
+    }
+
+    temporal_mode mode_;
+    float alpha_;
+    int window_;
+    float reset_;
+
+    // index of the history slot the next frame goes into
+    int next_;
+    std::vector<float> avg_;
+    std::vector<std::uint16_t> history_;
+    std::vector<std::uint16_t> filtered_;
+    std::vector<float> scale_;
+
+    // origin of the rays the points are moved along
+    bool origin_known_;
+    float origin_[3];
+
+  }; // end: class TemporalFilter
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_TEMPORAL_FILTER_H__
@@ -0,0 +1,178 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_THREAD_CONFIG_H__
+#define __O3D3XX_ROS_THREAD_CONFIG_H__
+
+#include <pthread.h>
+#include <sched.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <ros/ros.h>
+
+/**
+ * Placement of the driver's and the file writer's threads: the CPUs they may
+ * run on and their scheduling priority. All of it is optional, threads are
+ * left to the kernel by default.
+ *
+ * Failing to apply a setting, typically for lack of permission to use
+ * real-time scheduling, is logged and otherwise ignored; the thread runs
+ * anyway, just not where or as asked.
+ */
+namespace o3d3xx_ros
+{
+  /**
+   * Throws if `cpus', the value of parameter `param', names a CPU that
+   * cannot exist
+   */
+  inline void CheckCpus(const std::vector<int>& cpus, const std::string& param)
+  {
+    for (int cpu : cpus)
+      {
+	if ((cpu < 0) || (cpu >= CPU_SETSIZE))
+	  {
+	    throw std::runtime_error("Invalid CPU in " + param + ": " +
+				     std::to_string(cpu));
+	  }
+      }
+  }
+
+  /**
+   * Throws if `priority', the value of parameter `param', is neither 0 (no
+   * real-time scheduling) nor a SCHED_FIFO priority
+   */
+  inline void CheckPriority(int priority, const std::string& param)
+  {
+    if ((priority < 0) || (priority > sched_get_priority_max(SCHED_FIFO)))
+      {
+	throw std::runtime_error("Invalid " + param + ": " +
+				 std::to_string(priority));
+      }
+  }
+
+  /**
+   * Restricts `thread' to `cpus'; an empty list leaves it alone. Returns
+   * false, with the reason in `err', if that failed.
+   */
+  inline bool SetAffinity(pthread_t thread, const std::vector<int>& cpus,
+			  std::string& err)
+  {
+    if (cpus.empty())
+      {
+	return true;
+      }
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : cpus)
+      {
+	CPU_SET(cpu, &set);
+      }
+
+    int rc = pthread_setaffinity_np(thread, sizeof(set), &set);
+    if (rc != 0)
+      {
+	err = std::strerror(rc);
+	return false;
+      }
+    return true;
+  }
+
+  /**
+   * Names the calling thread `name' (at most 15 characters show in `top'
+   * and `ps'), restricts it to `cpus' and, if `priority' is above 0, has it
+   * scheduled SCHED_FIFO at that priority.
+   */
+  inline void ConfigureThread(const std::string& name,
+			      const std::vector<int>& cpus, int priority)
+  {
+    pthread_t self = pthread_self();
+    pthread_setname_np(self, name.substr(0, 15).c_str());
+
+    std::string err;
+    if (! SetAffinity(self, cpus, err))
+      {
+	ROS_WARN("Could not pin thread %s: %s", name.c_str(), err.c_str());
+      }
+
+    if (priority > 0)
+      {
+	sched_param param;
+	param.sched_priority = priority;
+	int rc = pthread_setschedparam(self, SCHED_FIFO, &param);
+	if (rc != 0)
+	  {
+	    ROS_WARN("Could not make thread %s real-time (priority %d): %s",
+		     name.c_str(), priority, std::strerror(rc));
+	  }
+      }
+  }
+
+  /**
+   * Restricts the calling thread to `cpus' for as long as it exists, e.g.,
+   * so the threads of a `ros::AsyncSpinner' started meanwhile inherit it.
+   */
+  class ScopedAffinity
+  {
+  public:
+    explicit ScopedAffinity(const std::vector<int>& cpus)
+      : restore_(false)
+    {
+      if (cpus.empty())
+	{
+	  return;
+	}
+
+      pthread_t self = pthread_self();
+      std::string err;
+      if (pthread_getaffinity_np(self, sizeof(this->saved_),
+				 &this->saved_) != 0)
+	{
+	  ROS_WARN("Could not read the CPU affinity, not pinning");
+	  return;
+	}
+
+      if (! SetAffinity(self, cpus, err))
+	{
+	  ROS_WARN("Could not pin threads: %s", err.c_str());
+	  return;
+	}
+      this->restore_ = true;
+    }
+
+    ~ScopedAffinity()
+    {
+      if (this->restore_)
+	{
+	  pthread_setaffinity_np(pthread_self(), sizeof(this->saved_),
+				 &this->saved_);
+	}
+    }
+
+  private:
+    ScopedAffinity(const ScopedAffinity&) = delete;
+    ScopedAffinity& operator=(const ScopedAffinity&) = delete;
+
+    bool restore_;
+    cpu_set_t saved_;
+
+  }; // end: class ScopedAffinity
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_THREAD_CONFIG_H__
@@ -0,0 +1,127 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_TIMESTAMP_H__
+#define __O3D3XX_ROS_TIMESTAMP_H__
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <ros/ros.h>
+
+namespace o3d3xx_ros
+{
+  /**
+   * Reads the acquisition time stamp the camera wrote into the header of the
+   * first image chunk of a raw frame, as returned by `ImageBuffer::Bytes()'.
+   *
+   * Only chunk headers of version 2 or later carry a time stamp (seconds and
+   * nanoseconds, on the camera's clock, at byte offsets 40 and 44 of the
+   * header); for older firmware this returns false and leaves `stamp' alone.
+   */
+  inline bool ChunkTimestamp(const std::vector<std::uint8_t>& bytes,
+			     ros::Time& stamp)
+  {
+    // the first chunk follows the 8 byte frame preamble
+    const std::size_t idx = 8;
+    if (bytes.size() < idx + 48)
+      {
+	return false;
+      }
+
+    std::uint32_t header_size, header_version, sec, nsec;
+    std::memcpy(&header_size, bytes.data() + idx + 8, sizeof(std::uint32_t));
+    std::memcpy(&header_version, bytes.data() + idx + 12,
+		sizeof(std::uint32_t));
+
+    if ((header_version < 2) || (header_size < 48))
+      {
+	return false;
+      }
+
+    std::memcpy(&sec, bytes.data() + idx + 40, sizeof(std::uint32_t));
+    std::memcpy(&nsec, bytes.data() + idx + 44, sizeof(std::uint32_t));
+    if (nsec >= 1000000000)
+      {
+	return false;
+      }
+
+    stamp = ros::Time(sec, nsec);
+    return true;
+  }
+
+  /**
+   * Translates time stamps from a device clock to the host clock.
+   *
+   * The offset between the two clocks is estimated as the smallest observed
+   * difference between when a frame was received on the host and when the
+   * device says it was taken, i.e., the offset plus the fastest transfer seen.
+   * The minimum is taken over windows of `window' frames, so the estimate
+   * follows slow drift of either clock.
+   */
+  class ClockOffsetEstimator
+  {
+  public:
+    explicit ClockOffsetEstimator(int window = 300)
+      : window_(window > 0 ? window : 1),
+	count_(0),
+	window_min_(0.0),
+	estimate_(0.0),
+	valid_(false)
+    { }
+
+    /**
+     * Feeds the estimator with a frame stamped `device' by the camera and
+     * received at `host'. Returns `device' translated to the host clock.
+     */
+    ros::Time Translate(const ros::Time& device, const ros::Time& host)
+    {
+      double offset = host.toSec() - device.toSec();
+
+      if ((this->count_ == 0) || (offset < this->window_min_))
+	{
+	  this->window_min_ = offset;
+	}
+
+      if ((! this->valid_) || (offset < this->estimate_))
+	{
+	  // no complete window yet, or a faster transfer than any seen before
+	  this->estimate_ = this->window_min_;
+	}
+
+      if (++this->count_ >= this->window_)
+	{
+	  this->estimate_ = this->window_min_;
+	  this->valid_ = true;
+	  this->count_ = 0;
+	}
+
+      return ros::Time().fromSec(device.toSec() + this->estimate_);
+    }
+
+  private:
+    int window_;
+    int count_;
+    double window_min_;
+    double estimate_;
+    bool valid_;
+
+  }; // end: class ClockOffsetEstimator
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_TIMESTAMP_H__
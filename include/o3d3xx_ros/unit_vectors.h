@@ -0,0 +1,316 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_UNIT_VECTORS_H__
+#define __O3D3XX_ROS_UNIT_VECTORS_H__
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <o3d3xx/image.h>
+#include <opencv2/opencv.hpp>
+#include <pcl/point_cloud.h>
+#include <o3d3xx/UnitVectors.h>
+#include <o3d3xx_ros/ray_origin.h>
+
+namespace o3d3xx_ros
+{
+  /**
+   * Where the points of a played back `cloud' topic come from
+   */
+  enum class cloud_source : int
+  {
+    CAMERA = 0,      // the clouds recorded from the camera
+    UNIT_VECTORS = 1 // also rebuilt from the depth and the rays, if missing
+  };
+
+  inline cloud_source ParseCloudSource(const std::string& name)
+  {
+    if (name == "camera")
+      {
+	return cloud_source::CAMERA;
+      }
+    else if (name == "unit_vectors")
+      {
+	return cloud_source::UNIT_VECTORS;
+      }
+
+    throw std::runtime_error("Invalid cloud_source: " + name);
+  }
+
+  /**
+   * Learns the rays of the camera's pixels from frames that carry both the
+   * point cloud and the radial depth, for `o3d3xx::UnitVectors'.
+   *
+   * The rays all start at one origin, the translation of the camera's
+   * extrinsic calibration, found by `FitRayOrigin' from the points of the
+   * first frame that determines it; frames before that are skipped. Each
+   * pixel's unit vector is then the direction from the origin to its point
+   * the first time the pixel is valid. Learning is done once every pixel
+   * has been valid, or after `max_frames' frames counted from the first.
+   *
+   * A learner is not thread-safe.
+   */
+  class UnitVectorLearner
+  {
+  public:
+    explicit UnitVectorLearner(int max_frames = 50)
+      : max_frames_(max_frames)
+    {
+      this->Reset();
+    }
+
+    /**
+     * Forgets everything, e.g., after the camera was reconfigured
+     */
+    void Reset()
+    {
+      this->height_ = 0;
+      this->width_ = 0;
+      this->frames_ = 0;
+      this->known_ = 0;
+      this->origin_[0] = this->origin_[1] = this->origin_[2] = 0.0f;
+      this->x_.clear();
+      this->y_.clear();
+      this->z_.clear();
+    }
+
+    bool Complete() const
+    {
+      return (this->frames_ > 0) &&
+	((this->known_ == this->x_.size()) ||
+	 (this->frames_ >= this->max_frames_));
+    }
+
+    /**
+     * Learns from a frame: its organized `cloud', in meters, and its
+     * CV_16UC1 `depth', in millimeters, and CV_8UC1 `confidence' images.
+     * Returns true if any rays were learned.
+     */
+    bool Learn(const pcl::PointCloud<o3d3xx::PointT>& cloud,
+	       const cv::Mat& depth, const cv::Mat& confidence)
+    {
+      std::size_t n = depth.total();
+      if ((depth.type() != CV_16UC1) || (n == 0) ||
+	  (confidence.total() != n) || (cloud.points.size() != n))
+	{
+	  return false;
+	}
+
+      if ((static_cast<int>(this->height_) != depth.rows) ||
+	  (static_cast<int>(this->width_) != depth.cols))
+	{
+	  this->Reset();
+	  this->height_ = depth.rows;
+	  this->width_ = depth.cols;
+	  this->x_.assign(n, 0.0f);
+	  this->y_.assign(n, 0.0f);
+	  this->z_.assign(n, 0.0f);
+	}
+
+      if (this->Complete())
+	{
+	  return false;
+	}
+
+      // no ray is right without the origin, so frames that do not
+      // determine it are not counted and the next one is tried
+      if ((this->frames_ == 0) &&
+	  (! FitRayOrigin(cloud, depth, confidence, this->origin_)))
+	{
+	  return false;
+	}
+      this->frames_++;
+
+      std::size_t known = this->known_;
+      for (int r = 0; r < depth.rows; ++r)
+	{
+	  const std::uint16_t* d = depth.ptr<std::uint16_t>(r);
+	  const std::uint8_t* c = confidence.ptr<std::uint8_t>(r);
+
+	  for (int col = 0; col < depth.cols; ++col)
+	    {
+	      std::size_t i = static_cast<std::size_t>(r) * depth.cols + col;
+	      const o3d3xx::PointT& pt = cloud.points[i];
+	      if ((this->x_[i] != 0.0f) || (this->y_[i] != 0.0f) ||
+		  (this->z_[i] != 0.0f) ||
+		  (! RayValid(pt, d[col], c[col])))
+		{
+		  continue;
+		}
+
+	      float dx = pt.x - this->origin_[0];
+	      float dy = pt.y - this->origin_[1];
+	      float dz = pt.z - this->origin_[2];
+	      float len = std::sqrt(dx * dx + dy * dy + dz * dz);
+	      if (len <= 0.0f)
+		{
+		  continue;
+		}
+
+	      this->x_[i] = dx / len;
+	      this->y_[i] = dy / len;
+	      this->z_[i] = dz / len;
+	      this->known_++;
+	    }
+	}
+
+      return this->known_ != known;
+    }
+
+    /**
+     * Everything learned so far, into all of `msg' but the header
+     */
+    void Fill(o3d3xx::UnitVectors& msg) const
+    {
+      msg.height = this->height_;
+      msg.width = this->width_;
+      for (int i = 0; i < 3; ++i)
+	{
+	  msg.origin[i] = this->origin_[i];
+	}
+      msg.x = this->x_;
+      msg.y = this->y_;
+      msg.z = this->z_;
+      msg.complete = this->Complete();
+    }
+
+    /**
+     * Takes over the complete table in `msg', e.g., one saved by an earlier
+     * run, as if it had been learned. Returns false, leaving the learner
+     * alone, if `msg' is incomplete or inconsistent.
+     */
+    bool Restore(const o3d3xx::UnitVectors& msg)
+    {
+      std::size_t n = static_cast<std::size_t>(msg.height) * msg.width;
+      if ((! msg.complete) || (n == 0) || (msg.x.size() != n) ||
+	  (msg.y.size() != n) || (msg.z.size() != n))
+	{
+	  return false;
+	}
+
+      this->Reset();
+      this->height_ = msg.height;
+      this->width_ = msg.width;
+      for (int i = 0; i < 3; ++i)
+	{
+	  this->origin_[i] = msg.origin[i];
+	}
+      this->x_ = msg.x;
+      this->y_ = msg.y;
+      this->z_ = msg.z;
+      this->frames_ = std::max(this->max_frames_, 1);
+      for (std::size_t i = 0; i < n; ++i)
+	{
+	  if ((this->x_[i] != 0.0f) || (this->y_[i] != 0.0f) ||
+	      (this->z_[i] != 0.0f))
+	    {
+	      this->known_++;
+	    }
+	}
+      return true;
+    }
+
+  private:
+    int max_frames_;
+    std::uint32_t height_;
+    std::uint32_t width_;
+    int frames_;
+    std::size_t known_;
+    float origin_[3];
+    std::vector<float> x_;
+    std::vector<float> y_;
+    std::vector<float> z_;
+
+  }; // end: class UnitVectorLearner
+
+  /**
+   * Rebuilds the organized point cloud of a frame from its CV_16UC1 radial
+   * `depth', in millimeters, its CV_8UC1 `confidence' and the rays in `uv'.
+   * If `amplitude' is a CV_16UC1 image of the same size, it becomes the
+   * intensity. Like in the camera's own cloud, pixels flagged invalid (bit
+   * 0 of their confidence set), with no depth or with no known ray become
+   * NaN points, and `is_dense' is cleared. The header of `cloud' is left
+   * alone.
+   *
+   * The points are computed with plain arithmetic and selects from the
+   * planar unit vectors, so the compiler can vectorize the loop. Returns
+   * false if `uv' or `confidence' does not match `depth'.
+   */
+  inline bool ReconstructCloud(const o3d3xx::UnitVectors& uv,
+			       const cv::Mat& depth, const cv::Mat& amplitude,
+			       const cv::Mat& confidence,
+			       pcl::PointCloud<o3d3xx::PointT>& cloud)
+  {
+    std::size_t n = depth.total();
+    if ((depth.type() != CV_16UC1) || (confidence.type() != CV_8UC1) ||
+	(confidence.rows != depth.rows) || (confidence.cols != depth.cols) ||
+	(static_cast<int>(uv.height) != depth.rows) ||
+	(static_cast<int>(uv.width) != depth.cols) ||
+	(uv.x.size() != n) || (uv.y.size() != n) || (uv.z.size() != n))
+      {
+	return false;
+      }
+
+    bool intensity = (amplitude.type() == CV_16UC1) &&
+      (amplitude.rows == depth.rows) && (amplitude.cols == depth.cols);
+
+    cloud.points.resize(n);
+    cloud.height = depth.rows;
+    cloud.width = depth.cols;
+    cloud.is_dense = false;
+
+    const float nan = std::numeric_limits<float>::quiet_NaN();
+    const float ox = uv.origin[0];
+    const float oy = uv.origin[1];
+    const float oz = uv.origin[2];
+
+    for (int r = 0; r < depth.rows; ++r)
+      {
+	std::size_t off = static_cast<std::size_t>(r) * depth.cols;
+	const std::uint16_t* d = depth.ptr<std::uint16_t>(r);
+	const std::uint8_t* c = confidence.ptr<std::uint8_t>(r);
+	const std::uint16_t* a =
+	  intensity ? amplitude.ptr<std::uint16_t>(r) : nullptr;
+	const float* ex = uv.x.data() + off;
+	const float* ey = uv.y.data() + off;
+	const float* ez = uv.z.data() + off;
+	o3d3xx::PointT* pts = cloud.points.data() + off;
+
+	for (int col = 0; col < depth.cols; ++col)
+	  {
+	    float m = d[col] * 0.001f;
+	    bool valid = ((c[col] & 1) == 0) && (d[col] != 0) &&
+	      ((ex[col] != 0.0f) || (ey[col] != 0.0f) || (ez[col] != 0.0f));
+
+	    pts[col].x = valid ? ox + m * ex[col] : nan;
+	    pts[col].y = valid ? oy + m * ey[col] : nan;
+	    pts[col].z = valid ? oz + m * ez[col] : nan;
+	    pts[col].intensity = intensity ? a[col] : 0.0f;
+	  }
+      }
+
+    return true;
+  }
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_UNIT_VECTORS_H__
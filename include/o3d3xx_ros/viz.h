@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __O3D3XX_ROS_VIZ_H__
+#define __O3D3XX_ROS_VIZ_H__
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <opencv2/opencv.hpp>
+
+namespace o3d3xx_ros
+{
+  /**
+   * Renders the visualization images -- colorized depth, good/bad pixel mask
+   * and amplitude histogram -- straight into caller provided buffers.
+   *
+   * All requested outputs are computed in two passes over the frame: the
+   * first finds the depth and amplitude ranges and writes the good/bad mask,
+   * the second colorizes depth and bins amplitude. The inner loops are kept
+   * to plain arithmetic on contiguous rows so the compiler can vectorize
+   * them for whatever the target is (SSE, NEON, ...); the colormap is a
+   * lookup table built once from OpenCV's, so the output matches
+   * `cv::applyColorMap'.
+   *
+   * A renderer is not thread-safe, each publishing thread should own its own.
+   */
+  class VizRenderer
+  {
+  public:
+    // size of the histogram plot, as drawn by `o3d3xx::hist1'
+    static const int HIST_ROWS = 400;
+    static const int HIST_COLS = 512;
+    static const int HIST_BINS = 256;
+
+    VizRenderer()
+      : bins_(HIST_BINS),
+	norm_(HIST_BINS)
+    {
+      cv::Mat ramp(1, 256, CV_8UC1);
+      for (int i = 0; i < 256; ++i)
+	{
+	  ramp.ptr<std::uint8_t>(0)[i] = static_cast<std::uint8_t>(i);
+	}
+
+      cv::Mat jet;
+      cv::applyColorMap(ramp, jet, cv::COLORMAP_JET);
+      std::memcpy(this->jet_, jet.ptr<std::uint8_t>(0), sizeof(this->jet_));
+    }
+
+    /**
+     * `depth' and `amplitude' are CV_16UC1 and `confidence' CV_8UC1 images
+     * of the same size. Each of the outputs may be null to skip it;
+     * otherwise `depth_viz' must be a CV_8UC3 and `good_bad' a CV_8UC1 image
+     * of the input size, and `hist' a HIST_ROWS x HIST_COLS CV_8UC3 image.
+     */
+    void Render(const cv::Mat& depth, const cv::Mat& amplitude,
+		const cv::Mat& confidence, cv::Mat* depth_viz,
+		cv::Mat* good_bad, cv::Mat* hist)
+    {
+      const int rows = depth.rows;
+      const int cols = depth.cols;
+
+      std::uint16_t depth_max = 0;
+      std::uint16_t amp_min = 0xffff;
+      std::uint16_t amp_max = 0;
+
+      //
+      // pass 1: ranges and good/bad mask
+      //
+      for (int r = 0; r < rows; ++r)
+	{
+	  if (depth_viz != nullptr)
+	    {
+	      const std::uint16_t* d = depth.ptr<std::uint16_t>(r);
+	      std::uint16_t m = depth_max;
+	      for (int c = 0; c < cols; ++c)
+		{
+		  m = d[c] > m ? d[c] : m;
+		}
+	      depth_max = m;
+	    }
+
+	  if (hist != nullptr)
+	    {
+	      const std::uint16_t* a = amplitude.ptr<std::uint16_t>(r);
+	      std::uint16_t lo = amp_min;
+	      std::uint16_t hi = amp_max;
+	      for (int c = 0; c < cols; ++c)
+		{
+		  lo = a[c] < lo ? a[c] : lo;
+		  hi = a[c] > hi ? a[c] : hi;
+		}
+	      amp_min = lo;
+	      amp_max = hi;
+	    }
+
+	  if (good_bad != nullptr)
+	    {
+	      // bit 0 of the confidence image is set for invalid pixels
+	      const std::uint8_t* conf = confidence.ptr<std::uint8_t>(r);
+	      std::uint8_t* out = good_bad->ptr<std::uint8_t>(r);
+	      for (int c = 0; c < cols; ++c)
+		{
+		  out[c] = static_cast<std::uint8_t>(-(conf[c] & 1));
+		}
+	    }
+	}
+
+      //
+      // pass 2: colorize depth, bin amplitude
+      //
+
+      // 16.16 fixed point scale factors, the products stay below 2^32
+      // because every value is within its range
+      std::uint32_t depth_scale =
+	depth_max > 0 ? ((255u << 16) + depth_max / 2) / depth_max : 0;
+      std::uint32_t amp_range =
+	amp_max >= amp_min ? amp_max - amp_min + 1u : 1u;
+      std::uint32_t amp_scale = (HIST_BINS << 16) / amp_range;
+
+      if (hist != nullptr)
+	{
+	  std::fill(this->bins_.begin(), this->bins_.end(), 0);
+	}
+
+      for (int r = 0; r < rows; ++r)
+	{
+	  if (depth_viz != nullptr)
+	    {
+	      const std::uint16_t* d = depth.ptr<std::uint16_t>(r);
+	      std::uint8_t* out = depth_viz->ptr<std::uint8_t>(r);
+	      for (int c = 0; c < cols; ++c)
+		{
+		  std::uint32_t v = (d[c] * depth_scale + 0x8000) >> 16;
+		  const std::uint8_t* bgr = this->jet_[v > 255 ? 255 : v];
+		  out[3*c] = bgr[0];
+		  out[3*c + 1] = bgr[1];
+		  out[3*c + 2] = bgr[2];
+		}
+	    }
+
+	  if (hist != nullptr)
+	    {
+	      const std::uint16_t* a = amplitude.ptr<std::uint16_t>(r);
+	      int* bins = this->bins_.data();
+	      for (int c = 0; c < cols; ++c)
+		{
+		  bins[((a[c] - amp_min) * amp_scale) >> 16]++;
+		}
+	    }
+	}
+
+      if (hist != nullptr)
+	{
+	  this->DrawHist(*hist);
+	}
+    }
+
+  private:
+    /**
+     * Plots `bins_', scaled to the height of the image, as blue line
+     * segments on black.
+     */
+    void DrawHist(cv::Mat& hist)
+    {
+      int lo = *std::min_element(this->bins_.begin(), this->bins_.end());
+      int hi = *std::max_element(this->bins_.begin(), this->bins_.end());
+      double scale = hi > lo ? static_cast<double>(hist.rows) / (hi - lo) : 0.0;
+
+      for (int i = 0; i < HIST_BINS; ++i)
+	{
+	  this->norm_[i] = cvRound((this->bins_[i] - lo) * scale);
+	}
+
+      hist.setTo(cv::Scalar(0, 0, 0));
+
+      const int bin_w = cvRound(static_cast<double>(hist.cols) / HIST_BINS);
+      for (int i = 1; i < HIST_BINS; ++i)
+	{
+	  cv::line(hist,
+		   cv::Point(bin_w * (i - 1), hist.rows - this->norm_[i - 1]),
+		   cv::Point(bin_w * i, hist.rows - this->norm_[i]),
+		   cv::Scalar(255, 0, 0), 2, 8, 0);
+	}
+    }
+
+    std::uint8_t jet_[256][3];
+    std::vector<int> bins_;
+    std::vector<int> norm_;
+
+  }; // end: class VizRenderer
+
+} // end: namespace o3d3xx_ros
+
+#endif // __O3D3XX_ROS_VIZ_H__
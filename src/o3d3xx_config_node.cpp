@@ -14,23 +14,42 @@
  * limitations under the License.
  */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
 #include <fstream>
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <vector>
+#include <boost/filesystem.hpp>
 #include <ros/ros.h>
 #include "o3d3xx/Config.h"
+#include "o3d3xx_ros/config_diff.h"
 
-int main(int argc, char **argv)
+/**
+ * One camera to configure and, once done, how it went
+ */
+struct ConfigJob
 {
+  std::string ns;
   std::string infile;
   std::string json;
 
-  ros::init(argc, argv, "o3d3xx_config");
-
-  ros::NodeHandle nh("~");
-  nh.param("infile", infile, std::string("-"));
+  bool called;
+  int status;
+  std::string msg;
+  double seconds;
+};
 
+/**
+ * Reads all of `infile', or of stdin if it is `-', into `json'
+ */
+static bool ReadJSON(const std::string& infile, std::string& json)
+{
   if (infile == "-")
     {
       std::string line;
@@ -41,35 +60,224 @@ int main(int argc, char **argv)
 	}
 
       json.assign(buff.str());
+      return true;
+    }
+
+  std::ifstream ifs(infile, std::ios::in);
+  if (! ifs)
+    {
+      ROS_ERROR("Failed to open file: %s", infile.c_str());
+      return false;
+    }
+
+  json.assign((std::istreambuf_iterator<char>(ifs)),
+	      (std::istreambuf_iterator<char>()));
+  return true;
+}
+
+/**
+ * Reads the manifest, a JSON object mapping the namespace of each camera's
+ * `Config' service to the JSON file to configure it with, into `jobs'.
+ * Relative paths are relative to the manifest.
+ */
+static bool ReadManifest(const std::string& manifest,
+			 std::vector<ConfigJob>& jobs)
+{
+  std::string json;
+  if (! ReadJSON(manifest, json))
+    {
+      return false;
+    }
+
+  o3d3xx_ros::config::ptree tree;
+  try
+    {
+      tree = o3d3xx_ros::config::Parse(json);
+    }
+  catch (const std::exception& ex)
+    {
+      ROS_ERROR("Invalid manifest %s: %s", manifest.c_str(), ex.what());
+      return false;
     }
-  else
+
+  boost::filesystem::path dir =
+    boost::filesystem::path(manifest).parent_path();
+
+  for (auto& entry : tree)
     {
-      std::ifstream ifs(infile, std::ios::in);
-      if (! ifs)
+      ConfigJob job;
+      job.ns = entry.first;
+      while ((! job.ns.empty()) && (job.ns.back() == '/'))
 	{
-	  ROS_ERROR("Failed to open file: %s", infile.c_str());
-	  return -1;
+	  job.ns.pop_back();
 	}
+      job.infile = entry.second.data();
+      job.called = false;
+      job.status = 0;
+      job.seconds = 0.0;
 
-      json.assign((std::istreambuf_iterator<char>(ifs)),
-		  (std::istreambuf_iterator<char>()));
+      if (job.ns.empty() || job.infile.empty() || (! entry.second.empty()))
+	{
+	  ROS_ERROR("Invalid manifest %s: expected "
+		    "{\"<namespace>\": \"<file>\", ...}", manifest.c_str());
+	  return false;
+	}
+
+      if (boost::filesystem::path(job.infile).is_relative())
+	{
+	  job.infile = (dir / job.infile).string();
+	}
+
+      if (! ReadJSON(job.infile, job.json))
+	{
+	  return false;
+	}
+
+      jobs.push_back(job);
     }
 
-  ros::ServiceClient client = nh.serviceClient<o3d3xx::Config>("/Config");
+  return true;
+}
+
+/**
+ * Calls the `Config' service in `job.ns' with `job.json', waiting up to
+ * `wait' seconds for it to come up. A relative `job.ns' is resolved in the
+ * namespace of `nh'.
+ */
+static void Configure(ros::NodeHandle& nh, ConfigJob& job, double wait)
+{
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  ros::ServiceClient client =
+    nh.serviceClient<o3d3xx::Config>(job.ns + "/Config");
 
   o3d3xx::Config srv;
-  srv.request.json = json;
+  srv.request.json = job.json;
+
+  job.called = client.waitForExistence(ros::Duration(wait)) &&
+    client.call(srv);
+  job.status = srv.response.status;
+  job.msg = srv.response.msg;
+  job.seconds = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - start).count();
+}
+
+int main(int argc, char **argv)
+{
+  std::string infile;
+  std::string manifest;
+  int parallel;
+  double wait;
+
+  ros::init(argc, argv, "o3d3xx_config");
+
+  ros::NodeHandle nh("~");
+  nh.param("infile", infile, std::string("-"));
+  nh.param("manifest", manifest, std::string(""));
+  nh.param("parallel", parallel, 8);
+  nh.param("service_timeout", wait, 5.0);
+
+  //--------------------------------
+  // A single camera, at `/Config'
+  //--------------------------------
+  if (manifest.empty())
+    {
+      std::string json;
+      if (! ReadJSON(infile, json))
+	{
+	  return -1;
+	}
+
+      ros::ServiceClient client = nh.serviceClient<o3d3xx::Config>("/Config");
+
+      o3d3xx::Config srv;
+      srv.request.json = json;
+
+      if (client.call(srv))
+	{
+	  ROS_INFO("status=%d", srv.response.status);
+	  ROS_INFO("msg=%s", srv.response.msg.c_str());
+	}
+      else
+	{
+	  ROS_ERROR("Failed to call `Config' service!");
+	  return 1;
+	}
+
+      return 0;
+    }
 
-  if (client.call(srv))
+  //--------------------------------
+  // A fleet, `parallel' at a time
+  //--------------------------------
+
+  // the cameras are not in our private namespace, so relative names in
+  // the manifest are resolved in the node's namespace, like any ROS name
+  ros::NodeHandle cameras;
+  std::vector<ConfigJob> jobs;
+  if (! ReadManifest(manifest, jobs))
     {
-      ROS_INFO("status=%d", srv.response.status);
-      ROS_INFO("msg=%s", srv.response.msg.c_str());
+      return -1;
     }
-  else
+
+  std::chrono::steady_clock::time_point start =
+    std::chrono::steady_clock::now();
+
+  std::atomic<std::size_t> next(0);
+  auto work = [&]()
+    {
+      for (std::size_t i = next++; i < jobs.size(); i = next++)
+	{
+	  ConfigJob& job = jobs[i];
+	  Configure(cameras, job, wait);
+
+	  if (! job.called)
+	    {
+	      ROS_ERROR("%s: failed to call `Config' service! (%.2f s)",
+			job.ns.c_str(), job.seconds);
+	    }
+	  else
+	    {
+	      ROS_INFO("%s: status=%d msg=%s (%.2f s)", job.ns.c_str(),
+		       job.status, job.msg.c_str(), job.seconds);
+	    }
+	}
+    };
+
+  std::vector<std::thread> workers;
+  std::size_t num_workers =
+    std::min(jobs.size(), static_cast<std::size_t>(std::max(parallel, 1)));
+  for (std::size_t i = 0; i < num_workers; ++i)
     {
-      ROS_ERROR("Failed to call `Config' service!");
-      return 1;
+      workers.emplace_back(work);
+    }
+
+  for (auto& worker : workers)
+    {
+      worker.join();
+    }
+
+  std::size_t failed = std::count_if(jobs.begin(), jobs.end(),
+				     [](const ConfigJob& job)
+				     {
+				       return (! job.called) ||
+					 (job.status != 0);
+				     });
+
+  ROS_INFO("Configured %lu of %lu cameras in %.2f s",
+	   (unsigned long) (jobs.size() - failed),
+	   (unsigned long) jobs.size(),
+	   std::chrono::duration<double>(
+	     std::chrono::steady_clock::now() - start).count());
+
+  for (auto& job : jobs)
+    {
+      if ((! job.called) || (job.status != 0))
+	{
+	  ROS_ERROR("Not configured: %s", job.ns.c_str());
+	}
     }
 
-  return 0;
+  return failed == 0 ? 0 : 1;
 }
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <memory>
+#include <thread>
+#include <nodelet/nodelet.h>
+#include <o3d3xx.h>
+#include <pluginlib/class_list_macros.h>
+#include <o3d3xx_ros/o3d3xx_file_writer_node.h>
+#include <o3d3xx_ros/o3d3xx_node.h>
+
+/**
+ * Nodelet wrapper around `O3D3xxNode'.
+ *
+ * When loaded into the same manager as a consumer (e.g., the file writer
+ * nodelet), published clouds and images are handed over as shared pointers
+ * and never serialized.
+ */
+class O3D3xxNodelet : public nodelet::Nodelet
+{
+public:
+  virtual ~O3D3xxNodelet()
+  {
+    if (this->node_)
+      {
+	this->node_->Stop();
+      }
+
+    if (this->thread_.joinable())
+      {
+	this->thread_.join();
+      }
+  }
+
+private:
+  virtual void onInit()
+  {
+    o3d3xx::Logging::Init();
+
+    // services are dispatched by the manager's thread pool, frames are
+    // published from our own thread since `Run()' blocks
+    this->node_.reset(new O3D3xxNode(this->getMTPrivateNodeHandle()));
+    this->thread_ = std::thread(&O3D3xxNode::Run, this->node_.get());
+  }
+
+  std::unique_ptr<O3D3xxNode> node_;
+  std::thread thread_;
+
+}; // end: class O3D3xxNodelet
+
+/**
+ * Nodelet wrapper around `O3D3xxFileWriterNode'.
+ */
+class O3D3xxFileWriterNodelet : public nodelet::Nodelet
+{
+private:
+  virtual void onInit()
+  {
+    this->node_.reset(
+      new O3D3xxFileWriterNode(this->getMTPrivateNodeHandle()));
+  }
+
+  std::unique_ptr<O3D3xxFileWriterNode> node_;
+
+}; // end: class O3D3xxFileWriterNodelet
+
+PLUGINLIB_EXPORT_CLASS(O3D3xxNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(O3D3xxFileWriterNodelet, nodelet::Nodelet)
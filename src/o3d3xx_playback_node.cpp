@@ -0,0 +1,29 @@
+/*
+ * Copyright (C) 2015 Love Park Robotics, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distribted on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <ros/ros.h>
+#include <o3d3xx_ros/o3d3xx_playback_node.h>
+
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "o3d3xx_playback");
+
+  ros::AsyncSpinner spinner(1);
+  O3D3xxPlaybackNode node(ros::NodeHandle("~"));
+  spinner.start();
+  node.Run();
+  return 0;
+}